@@ -0,0 +1,195 @@
+#include <iostream>
+#include <algorithm>
+#include "alloc.h"
+
+// marks all no_blocks blocks as used
+void
+FreeMap::reset(unsigned no_blocks)
+{
+    this->no_blocks = no_blocks;
+    words.assign((no_blocks + 63) / 64, 0);
+    free_count = 0;
+    hint = 0;
+}
+
+void
+FreeMap::set_free(unsigned block)
+{
+    if (block >= no_blocks || is_free(block)) {
+        return;
+    }
+    words[block / 64] |= (uint64_t)1 << (block % 64);
+    free_count++;
+}
+
+void
+FreeMap::set_used(unsigned block)
+{
+    if (block >= no_blocks || !is_free(block)) {
+        return;
+    }
+    words[block / 64] &= ~((uint64_t)1 << (block % 64));
+    free_count--;
+    hint = block / 64;
+}
+
+// returns a free block without allocating it, or -1 if the disk is full
+int
+FreeMap::find()
+{
+    if (free_count == 0) {
+        return -1;
+    }
+    unsigned no_words = words.size();
+    for (unsigned i = 0; i < no_words; i++) {
+        unsigned w = hint + i < no_words ? hint + i : hint + i - no_words;
+        if (words[w]) {
+            hint = w;
+            return w * 64 + __builtin_ctzll(words[w]);
+        }
+    }
+    return -1;
+}
+
+// allocates one free block, or returns -1 if the disk is full
+int
+FreeMap::alloc()
+{
+    int block = find();
+    if (block != -1) {
+        set_used(block);
+    }
+    return block;
+}
+
+// allocates count free blocks and appends them to blocks
+int
+FreeMap::alloc(unsigned count, std::vector<int> &blocks)
+{
+    if (count > free_count) {
+        return -1;
+    }
+    unsigned allocated = 0;
+    while (allocated < count) {
+        unsigned w = find() / 64;
+        // take the free blocks of this word in one go
+        while (words[w] && allocated < count) {
+            unsigned block = w * 64 + __builtin_ctzll(words[w]);
+            set_used(block);
+            blocks.push_back(block);
+            allocated++;
+        }
+    }
+    return 0;
+}
+
+// returns the first free block at or after block, or no_blocks if there is none
+unsigned
+FreeMap::next_free(unsigned block)
+{
+    unsigned w = block / 64;
+    if (w >= words.size()) {
+        return no_blocks;
+    }
+    uint64_t bits = words[w] & (~(uint64_t)0 << (block % 64));
+    while (!bits) {
+        if (++w == words.size()) {
+            return no_blocks;
+        }
+        bits = words[w];
+    }
+    return std::min(no_blocks, w * 64 + (unsigned)__builtin_ctzll(bits));
+}
+
+// returns the first used block at or after block, or no_blocks if there is none
+unsigned
+FreeMap::next_used(unsigned block)
+{
+    unsigned w = block / 64;
+    if (w >= words.size()) {
+        return no_blocks;
+    }
+    uint64_t bits = ~words[w] & (~(uint64_t)0 << (block % 64));
+    while (!bits) {
+        if (++w == words.size()) {
+            return no_blocks;
+        }
+        bits = ~words[w];
+    }
+    return std::min(no_blocks, w * 64 + (unsigned)__builtin_ctzll(bits));
+}
+
+// allocates count blocks in as few extents as possible
+int
+FreeMap::alloc_extents(unsigned count, std::vector<struct extent> &extents, int goal)
+{
+    if (count == 0) {
+        return 0;
+    }
+    if (count > free_count) {
+        return -1;
+    }
+
+    size_t first_new = extents.size();
+    struct extent found = { 0, 0 };
+    if (goal >= 0 && (unsigned)goal < no_blocks && is_free(goal)
+            && next_used(goal) - goal >= count) {
+        found.start = goal;
+        found.count = count;
+    }
+
+    // first fit, starting at the hint and wrapping around once
+    std::vector<struct extent> runs;
+    unsigned start = hint * 64;
+    for (int pass = 0; pass < 2 && found.count == 0; pass++) {
+        unsigned block = pass == 0 ? start : 0;
+        unsigned end = pass == 0 ? no_blocks : std::min(start, no_blocks);
+        while (block < end) {
+            unsigned run_start = next_free(block);
+            if (run_start >= end) {
+                break;
+            }
+            unsigned run_end = next_used(run_start);
+            if (run_end - run_start >= count) {
+                found.start = run_start;
+                found.count = count;
+                break;
+            }
+            // a run crossing the hint was partly seen in the first pass
+            run_end = std::min(run_end, end);
+            runs.push_back({ run_start, run_end - run_start });
+            block = run_end;
+        }
+    }
+
+    if (found.count == 0) {
+        // no single run is big enough, so the largest runs give the fewest extents
+        std::sort(runs.begin(), runs.end(), [](const struct extent &a, const struct extent &b) {
+            return a.count > b.count || (a.count == b.count && a.start < b.start);
+        });
+        unsigned remaining = count;
+        std::vector<struct extent> taken;
+        for (const struct extent &run : runs) {
+            if (remaining == 0) {
+                break;
+            }
+            unsigned n = std::min(remaining, run.count);
+            taken.push_back({ run.start, n });
+            remaining -= n;
+        }
+        // keep the chain in disk order, so it is read front to back
+        std::sort(taken.begin(), taken.end(), [](const struct extent &a, const struct extent &b) {
+            return a.start < b.start;
+        });
+        extents.insert(extents.end(), taken.begin(), taken.end());
+    } else {
+        extents.push_back(found);
+    }
+
+    for (size_t i = first_new; i < extents.size(); i++) {
+        for (unsigned b = extents[i].start; b < extents[i].start + extents[i].count; b++) {
+            set_used(b);
+        }
+    }
+    return 0;
+}
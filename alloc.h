@@ -0,0 +1,48 @@
+#include <iostream>
+#include <cstdint>
+#include <vector>
+
+#ifndef __ALLOC_H__
+#define __ALLOC_H__
+
+// a run of consecutive blocks
+struct extent {
+    unsigned start;
+    unsigned count;
+};
+
+// in-memory free-space bitmap built from the FAT at mount time. A set bit
+// means the block is free. Searches go a 64-bit word at a time and start
+// at a rolling hint, the word of the last allocation.
+class FreeMap {
+private:
+    std::vector<uint64_t> words;
+    unsigned no_blocks = 0;
+    unsigned free_count = 0;
+    unsigned hint = 0;
+
+    unsigned next_free(unsigned block);
+    unsigned next_used(unsigned block);
+public:
+    // marks all no_blocks blocks as used
+    void reset(unsigned no_blocks);
+    void set_free(unsigned block);
+    void set_used(unsigned block);
+    bool is_free(unsigned block) { return (words[block / 64] >> (block % 64)) & 1; }
+    // returns a free block without allocating it, or -1 if the disk is full
+    int find();
+    // allocates one free block, or returns -1 if the disk is full
+    int alloc();
+    // allocates count free blocks and appends them to blocks. Nothing is
+    // allocated if there are not enough free blocks, then -1 is returned.
+    int alloc(unsigned count, std::vector<int> &blocks);
+    // allocates count blocks in as few extents as possible. A single free run
+    // starting at goal is preferred (to extend an existing chain), then the
+    // first run that holds all count blocks, and if there is none the largest
+    // free runs are used. Returns -1 without allocating if the disk is too full.
+    int alloc_extents(unsigned count, std::vector<struct extent> &extents, int goal = -1);
+    unsigned get_free_count() { return free_count; }
+    unsigned get_no_blocks() { return no_blocks; }
+};
+
+#endif // __ALLOC_H__
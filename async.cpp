@@ -0,0 +1,99 @@
+#include <memory>
+#include "async.h"
+
+AsyncFS::AsyncFS(FS &fs, unsigned workers) : fs(fs)
+{
+    if (workers == 0) {
+        workers = 1;
+    }
+    for (unsigned w = 0; w < workers; w++) {
+        this->workers.push_back(std::thread(&AsyncFS::work, this));
+    }
+}
+
+AsyncFS::~AsyncFS()
+{
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        stopping = true;
+    }
+    queue_ready.notify_all();
+    for (std::thread &t : workers) {
+        t.join();
+    }
+}
+
+// one worker: runs queued operations until the queue is empty and stopping
+// is set
+void
+AsyncFS::work()
+{
+    for (;;) {
+        std::function<void()> op;
+        {
+            std::unique_lock<std::mutex> guard(queue_lock);
+            while (queue.empty() && !stopping) {
+                queue_ready.wait(guard);
+            }
+            if (queue.empty()) {
+                break;
+            }
+            op = std::move(queue.front());
+            queue.pop_front();
+        }
+        op();
+    }
+    fs.detach();
+}
+
+// queues op to run in the current directory of the calling thread
+std::future<int>
+AsyncFS::submit(std::function<int()> op, async_callback done)
+{
+    std::shared_ptr<std::promise<int>> result = std::make_shared<std::promise<int>>();
+    std::future<int> future = result->get_future();
+    uint32_t cwd = fs.get_cwd();
+    FS *fs = &this->fs;
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        queue.push_back([fs, cwd, op, done, result]() {
+            fs->set_cwd(cwd);
+            int ret = op();
+            if (done) {
+                done(ret);
+            }
+            result->set_value(ret);
+        });
+    }
+    queue_ready.notify_one();
+    return future;
+}
+
+std::future<int>
+AsyncFS::read(const std::string &filepath, uint32_t offset, uint32_t len, uint8_t *buf, async_callback done)
+{
+    FS *fs = &this->fs;
+    return submit([fs, filepath, offset, len, buf]() { return fs->pread(filepath, offset, len, buf); }, done);
+}
+
+std::future<int>
+AsyncFS::write(const std::string &filepath, uint32_t offset, const uint8_t *buf, uint32_t len, async_callback done)
+{
+    FS *fs = &this->fs;
+    return submit([fs, filepath, offset, buf, len]() { return fs->pwrite(filepath, offset, buf, len); }, done);
+}
+
+std::future<int>
+AsyncFS::create(const std::string &filepath, std::string data, async_callback done)
+{
+    FS *fs = &this->fs;
+    std::shared_ptr<std::string> content = std::make_shared<std::string>(std::move(data));
+    return submit([fs, filepath, content]() { return fs->create(filepath, *content); }, done);
+}
+
+std::future<int>
+AsyncFS::cp(const std::string &sourcepath, const std::string &destpath, bool reflink, async_callback done)
+{
+    FS *fs = &this->fs;
+    return submit([fs, sourcepath, destpath, reflink]() { return fs->cp(sourcepath, destpath, reflink); }, done);
+}
@@ -0,0 +1,54 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "fs.h"
+
+#ifndef __ASYNC_H__
+#define __ASYNC_H__
+
+#define ASYNC_WORKERS 8 // default number of I/O worker threads
+
+// completion callback, called with the result on the worker thread before
+// the future becomes ready
+typedef std::function<void(int)> async_callback;
+
+// asynchronous front end of an FS. Operations are put on a submission queue
+// and run by worker threads, each a client of the FS, so up to workers of
+// them are in flight at once: the lookups of one overlap the data transfers
+// of others. Every call returns a future with the return value of the FS
+// method of the same name. Relative paths are resolved from the current
+// directory of the submitting thread. Buffers passed to read and write must
+// stay valid until the future is ready.
+class AsyncFS {
+private:
+    FS &fs;
+    std::vector<std::thread> workers;
+    std::mutex queue_lock;
+    std::condition_variable queue_ready;
+    std::deque<std::function<void()>> queue; // submitted, not started yet
+    bool stopping = false;
+
+    void work();
+    std::future<int> submit(std::function<int()> op, async_callback done);
+public:
+    AsyncFS(FS &fs, unsigned workers = ASYNC_WORKERS);
+    // runs the operations still queued, then stops the workers
+    ~AsyncFS();
+    // pread of len bytes at offset of filepath into buf
+    std::future<int> read(const std::string &filepath, uint32_t offset, uint32_t len, uint8_t *buf,
+                          async_callback done = nullptr);
+    // pwrite of len bytes from buf at offset of filepath
+    std::future<int> write(const std::string &filepath, uint32_t offset, const uint8_t *buf, uint32_t len,
+                           async_callback done = nullptr);
+    std::future<int> create(const std::string &filepath, std::string data, async_callback done = nullptr);
+    std::future<int> cp(const std::string &sourcepath, const std::string &destpath, bool reflink = false,
+                        async_callback done = nullptr);
+};
+
+#endif // __ASYNC_H__
@@ -0,0 +1,126 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+#include "shell.h"
+#include "fs.h"
+#include "alloc.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+#define BENCH_INPUT "bench_input.txt"
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting benchmark...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting benchmark...\n";
+}
+
+static double
+elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the old allocator: scan the FAT from index 0 for every block
+static double
+fill_linear(unsigned no_blocks)
+{
+    std::vector<int32_t> fat(no_blocks, FAT_FREE);
+    fat[0] = FAT_EOF;
+    fat[1] = FAT_EOF;
+    auto start = std::chrono::steady_clock::now();
+    for (;;) {
+        unsigned i = 0;
+        while (i < no_blocks && fat[i] != FAT_FREE)
+            i++;
+        if (i == no_blocks)
+            break;
+        fat[i] = FAT_EOF;
+    }
+    return elapsed(start);
+}
+
+// the free map, one block per call
+static double
+fill_freemap(unsigned no_blocks)
+{
+    FreeMap freemap;
+    freemap.reset(no_blocks);
+    for (unsigned i = 2; i < no_blocks; i++)
+        freemap.set_free(i);
+    auto start = std::chrono::steady_clock::now();
+    while (freemap.alloc() != -1)
+        ;
+    return elapsed(start);
+}
+
+// the free map, count blocks per call
+static double
+fill_freemap_multi(unsigned no_blocks, unsigned count)
+{
+    FreeMap freemap;
+    std::vector<int> blocks;
+    freemap.reset(no_blocks);
+    for (unsigned i = 2; i < no_blocks; i++)
+        freemap.set_free(i);
+    auto start = std::chrono::steady_clock::now();
+    while (freemap.get_free_count() > 0) {
+        blocks.clear();
+        freemap.alloc(std::min(count, freemap.get_free_count()), blocks);
+    }
+    return elapsed(start);
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "Allocator benchmark: allocate every block of an empty disk" << std::endl;
+    PRINTDIV;
+    unsigned sizes[] = { 2048, 16384, 65536 };
+    for (unsigned no_blocks : sizes) {
+        std::cout << no_blocks << " blocks:" << std::endl;
+        std::cout << "  linear FAT scan      " << fill_linear(no_blocks) * 1e3 << " ms" << std::endl;
+        std::cout << "  free map, 1 block    " << fill_freemap(no_blocks) * 1e3 << " ms" << std::endl;
+        std::cout << "  free map, 32 blocks  " << fill_freemap_multi(no_blocks, 32) * 1e3 << " ms" << std::endl;
+    }
+    PRINTDIV2;
+
+    // 63 files of 32 blocks each do not fit, so the disk ends up full
+    std::cout << "File system benchmark: create 128 KiB files until the disk is full" << std::endl;
+    {
+        std::ofstream input(BENCH_INPUT);
+        std::string line(BLOCK_SIZE - 1, 'x');
+        for (int f = 0; f < 64; f++) {
+            for (int l = 0; l < 32; l++)
+                input << line << "\n";
+            input << "\n";
+        }
+    }
+    filesystem.format();
+    int fw = open(BENCH_INPUT, O_RDONLY);
+    int saved_stdin = dup(0);
+    dup2(fw, 0);
+    int files = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (files < 64 && filesystem.create("f" + std::to_string(files)) == 0)
+        files++;
+    double t = elapsed(start);
+    dup2(saved_stdin, 0);
+    close(saved_stdin);
+    close(fw);
+    std::remove(BENCH_INPUT);
+    std::cout << "  created " << files << " files (" << files * 32 << " blocks) in " << t * 1e3 << " ms" << std::endl;
+    filesystem.format();
+    PRINTDIV;
+}
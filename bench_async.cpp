@@ -0,0 +1,130 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <chrono>
+#include "shell.h"
+#include "fs.h"
+#include "async.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+#define BENCH_FILES 256 // files created, appended to, read and copied at every depth
+#define BENCH_FILE_SIZE (4 * BLOCK_SIZE) // size when created, doubled by the writes
+#define BENCH_READS 8 // times every file is read back
+#define BENCH_MAX_DEPTH 16
+#define BENCH_DISK_BLOCKS 8192 // room for the files and their copies
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting benchmark...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting benchmark...\n";
+}
+
+static double
+elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// keeps at most depth operations in flight: reserve() waits for the oldest
+// one if all slots are taken, the next operation is submitted after it
+class window {
+    unsigned depth;
+    std::deque<std::future<int>> in_flight;
+public:
+    int failed = 0;
+    window(unsigned depth) : depth(depth) {}
+    void reserve()
+    {
+        if (in_flight.size() == depth) {
+            drain(1);
+        }
+    }
+    void add(std::future<int> f)
+    {
+        in_flight.push_back(std::move(f));
+    }
+    // waits for the n oldest operations, all of them by default
+    void drain(size_t n = (size_t)-1)
+    {
+        while (n-- > 0 && !in_flight.empty()) {
+            if (in_flight.front().get() < 0) {
+                failed++;
+            }
+            in_flight.pop_front();
+        }
+    }
+};
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "Async benchmark: " << BENCH_FILES << " files of " << BENCH_FILE_SIZE / 1024
+              << " KiB, " << BENCH_MAX_DEPTH << " I/O workers" << std::endl;
+    PRINTDIV;
+    std::string data(BENCH_FILE_SIZE, 'a');
+    std::vector<uint8_t> bufs(BENCH_MAX_DEPTH * 2 * BENCH_FILE_SIZE);
+    unsigned depths[] = { 1, 2, 4, 8, 16 };
+    for (unsigned depth : depths) {
+        filesystem.format(BENCH_DISK_BLOCKS);
+        AsyncFS async(filesystem, BENCH_MAX_DEPTH);
+        window w(depth);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int f = 0; f < BENCH_FILES; f++) {
+            w.reserve();
+            w.add(async.create("/f" + std::to_string(f), data));
+        }
+        w.drain();
+        double tc = elapsed(start);
+
+        // appends at the block-aligned end of every file
+        start = std::chrono::steady_clock::now();
+        for (int f = 0; f < BENCH_FILES; f++) {
+            w.reserve();
+            w.add(async.write("/f" + std::to_string(f), BENCH_FILE_SIZE,
+                              reinterpret_cast<const uint8_t *>(data.data()), BENCH_FILE_SIZE));
+        }
+        w.drain();
+        double tw = elapsed(start);
+
+        // a buffer per slot of the window, the read that used a slot is
+        // done before the slot is reused
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCH_FILES * BENCH_READS; i++) {
+            uint8_t *buf = &bufs[(i % depth) * 2 * BENCH_FILE_SIZE];
+            w.reserve();
+            w.add(async.read("/f" + std::to_string(i % BENCH_FILES), 0, 2 * BENCH_FILE_SIZE, buf));
+        }
+        w.drain();
+        double tr = elapsed(start);
+
+        start = std::chrono::steady_clock::now();
+        for (int f = 0; f < BENCH_FILES; f++) {
+            w.reserve();
+            w.add(async.cp("/f" + std::to_string(f), "/c" + std::to_string(f)));
+        }
+        w.drain();
+        double tp = elapsed(start);
+
+        std::cout << "queue depth " << depth << ":" << std::endl;
+        std::cout << "  create  " << BENCH_FILES / tc << " files/s" << std::endl;
+        std::cout << "  write   " << BENCH_FILES / tw << " files/s" << std::endl;
+        std::cout << "  read    " << (double)BENCH_FILES * BENCH_READS / tr << " files/s" << std::endl;
+        std::cout << "  cp      " << BENCH_FILES / tp << " files/s" << std::endl;
+        if (w.failed) {
+            std::cout << "  " << w.failed << " operations failed" << std::endl;
+        }
+    }
+    PRINTDIV2;
+    filesystem.format(DEFAULT_NO_BLOCKS);
+    PRINTDIV;
+}
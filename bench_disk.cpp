@@ -0,0 +1,111 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "shell.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+#define BENCH_FILES 128 // files on the image, read and rewritten by every backend
+#define BENCH_FILE_SIZE (64 * BLOCK_SIZE)
+#define BENCH_READS 8 // times every file is read back
+#define BENCH_DISK_BLOCKS 16384 // room for the files
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting benchmark...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting benchmark...\n";
+}
+
+static double
+elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// throws away what cat writes, so only the reads are measured
+class null_buf : public std::streambuf {
+protected:
+    int overflow(int c) { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) { return n; }
+};
+
+// reads and rewrites every file of the image with one backend
+static void
+bench_backend(int backend, const char *name, int *failed)
+{
+    FS fs(backend);
+    null_buf discard;
+    std::ostream out(&discard);
+    std::vector<uint8_t> buf(BENCH_FILE_SIZE);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < BENCH_READS; r++) {
+        for (int f = 0; f < BENCH_FILES; f++) {
+            if (fs.cat("/f" + std::to_string(f), out)) {
+                (*failed)++;
+            }
+        }
+    }
+    double tc = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < BENCH_READS; r++) {
+        for (int f = 0; f < BENCH_FILES; f++) {
+            if (fs.pread("/f" + std::to_string(f), 0, buf.size(), buf.data()) != (int)buf.size()) {
+                (*failed)++;
+            }
+        }
+    }
+    double tr = elapsed(start);
+
+    // in place, the files keep their blocks
+    start = std::chrono::steady_clock::now();
+    for (int f = 0; f < BENCH_FILES; f++) {
+        if (fs.pwrite("/f" + std::to_string(f), 0, buf.data(), buf.size()) != (int)buf.size()) {
+            (*failed)++;
+        }
+    }
+    fs.sync();
+    double tw = elapsed(start);
+
+    double mib = (double)BENCH_FILES * BENCH_FILE_SIZE / (1024 * 1024);
+    std::cout << name << ":" << std::endl;
+    std::cout << "  cat     " << mib * BENCH_READS / tc << " MiB/s" << std::endl;
+    std::cout << "  pread   " << mib * BENCH_READS / tr << " MiB/s" << std::endl;
+    std::cout << "  pwrite  " << mib / tw << " MiB/s" << std::endl;
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "Disk backend benchmark: " << BENCH_FILES << " files of " << BENCH_FILE_SIZE / 1024
+              << " KiB on one image" << std::endl;
+    PRINTDIV;
+    filesystem.format(BENCH_DISK_BLOCKS);
+    std::string data(BENCH_FILE_SIZE, 'a');
+    for (int f = 0; f < BENCH_FILES; f++) {
+        filesystem.create("/f" + std::to_string(f), data);
+    }
+    filesystem.sync();
+
+    // every backend mounts the same image, the shell's file system stays
+    // idle meanwhile and formats the disk afterwards
+    int failed = 0;
+    bench_backend(DISK_BACKEND_STREAM, "stream", &failed);
+    bench_backend(DISK_BACKEND_PREAD, "pread", &failed);
+    bench_backend(DISK_BACKEND_MMAP, "mmap", &failed);
+    if (failed) {
+        std::cout << failed << " operations failed" << std::endl;
+    }
+    PRINTDIV2;
+    filesystem.format(DEFAULT_NO_BLOCKS);
+    PRINTDIV;
+}
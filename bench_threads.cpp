@@ -0,0 +1,109 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include "shell.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+#define BENCH_FILES 256 // files created in total, split between the threads
+#define BENCH_FILE_SIZE (4 * BLOCK_SIZE)
+#define BENCH_READS 8 // times every file is read back
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting benchmark...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting benchmark...\n";
+}
+
+static double
+elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// one client: creates its share of the files in its own directory
+static void
+create_files(FS *fs, int client, int files, int *failed)
+{
+    std::string data(BENCH_FILE_SIZE, 'a' + client % 26);
+    fs->cd("/d" + std::to_string(client));
+    for (int f = 0; f < files; f++) {
+        if (fs->create("f" + std::to_string(f), data)) {
+            (*failed)++;
+        }
+    }
+    fs->detach();
+}
+
+// one client: reads its files back, whole files with pread
+static void
+read_files(FS *fs, int client, int files, int *failed)
+{
+    std::vector<uint8_t> buf(BENCH_FILE_SIZE);
+    fs->cd("/d" + std::to_string(client));
+    for (int r = 0; r < BENCH_READS; r++) {
+        for (int f = 0; f < files; f++) {
+            if (fs->pread("f" + std::to_string(f), 0, buf.size(), buf.data()) != (int)buf.size()) {
+                (*failed)++;
+            }
+        }
+    }
+    fs->detach();
+}
+
+// runs fn in clients threads at once and returns the time taken
+static double
+run_clients(FS *fs, int clients, void (*fn)(FS*, int, int, int*), int *failed)
+{
+    std::vector<std::thread> threads;
+    std::vector<int> errors(clients, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < clients; c++) {
+        threads.push_back(std::thread(fn, fs, c, BENCH_FILES / clients, &errors[c]));
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    double t = elapsed(start);
+    for (int e : errors) {
+        *failed += e;
+    }
+    return t;
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "Concurrency benchmark: " << BENCH_FILES << " files of " << BENCH_FILE_SIZE / 1024
+              << " KiB, each client in its own directory" << std::endl;
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+    PRINTDIV;
+    int counts[] = { 1, 2, 4, 8 };
+    for (int clients : counts) {
+        int failed = 0;
+        filesystem.format();
+        for (int c = 0; c < clients; c++) {
+            filesystem.mkdir("/d" + std::to_string(c));
+        }
+        double tc = run_clients(&filesystem, clients, create_files, &failed);
+        double tr = run_clients(&filesystem, clients, read_files, &failed);
+        std::cout << clients << " client(s):" << std::endl;
+        std::cout << "  create  " << BENCH_FILES / tc << " files/s" << std::endl;
+        std::cout << "  read    " << (double)BENCH_FILES * BENCH_READS / tr << " files/s" << std::endl;
+        if (failed) {
+            std::cout << "  " << failed << " operations failed" << std::endl;
+        }
+    }
+    PRINTDIV2;
+    filesystem.format();
+    PRINTDIV;
+}
@@ -0,0 +1,444 @@
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "cache.h"
+
+BlockCache::BlockCache(Disk &disk, unsigned capacity) : disk(disk), capacity(capacity)
+{
+    if (this->capacity == 0) {
+        this->capacity = 1;
+    }
+}
+
+BlockCache::~BlockCache()
+{
+    sync_blocks();
+}
+
+// returns the cached block and marks it as most recently used
+BlockCache::cache_block *
+BlockCache::lookup(unsigned block_no)
+{
+    auto it = blocks.find(block_no);
+    if (it == blocks.end()) {
+        return nullptr;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    return &*it->second;
+}
+
+// counts a hit, and a readahead hit the first time a prefetched block is used
+void
+BlockCache::use(cache_block &cb)
+{
+    hits++;
+    if (cb.prefetched) {
+        cb.prefetched = false;
+        readahead_hits++;
+    }
+}
+
+// adds an (uninitialized) block to the cache, evicting if it is full
+BlockCache::cache_block *
+BlockCache::insert(unsigned block_no)
+{
+    while (blocks.size() >= capacity) {
+        int ret = evict();
+        if (ret == 1) {
+            break;
+        }
+        if (ret) {
+            return nullptr;
+        }
+    }
+    lru.emplace_front();
+    cache_block &cb = lru.front();
+    cb.block_no = block_no;
+    cb.dirty = false;
+    cb.prefetched = false;
+    cb.logged = false;
+    blocks[block_no] = lru.begin();
+    return &cb;
+}
+
+int
+BlockCache::write_back(cache_block &cb)
+{
+    if (!cb.dirty) {
+        return 0;
+    }
+    // never in place before it is in the journal
+    if (journal && journal->active() && !cb.logged && commit_blocks()) {
+        return -1;
+    }
+    if (disk.write(cb.block_no, cb.data)) {
+        return -1;
+    }
+    cb.dirty = false;
+    writebacks++;
+    return 0;
+}
+
+// removes the least recently used block. With a journal, blocks that are
+// not committed yet stay, so an operation reaches the disk as a whole. Returns
+// 1 if every cached block is such a block, the cache grows past its capacity
+// until the next commit then.
+int
+BlockCache::evict()
+{
+    auto it = std::prev(lru.end());
+    if (journal && journal->active()) {
+        while (it->dirty && !it->logged) {
+            if (it == lru.begin()) {
+                return 1;
+            }
+            --it;
+        }
+    }
+    if (write_back(*it)) {
+        return -1;
+    }
+    blocks.erase(it->block_no);
+    lru.erase(it);
+    return 0;
+}
+
+// reads one block, from the cache if possible
+int
+BlockCache::read(unsigned block_no, uint8_t *blk)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    cache_block *cb = lookup(block_no);
+    if (cb) {
+        use(*cb);
+    } else {
+        misses++;
+        cb = insert(block_no);
+        if (!cb || disk.read(block_no, cb->data)) {
+            if (cb) {
+                blocks.erase(block_no);
+                lru.pop_front();
+            }
+            return -1;
+        }
+    }
+    std::memcpy(blk, cb->data, BLOCK_SIZE);
+    return 0;
+}
+
+// writes one block into the cache, it reaches the disk later
+int
+BlockCache::write(unsigned block_no, uint8_t *blk)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (block_no >= disk.get_no_blocks()) {
+        std::cout << "BlockCache::write - ERROR: Invalid block number (" << block_no << ")\n";
+        return -1;
+    }
+    cache_block *cb = lookup(block_no);
+    if (!cb) {
+        cb = insert(block_no);
+        if (!cb) {
+            return -1;
+        }
+    }
+    std::memcpy(cb->data, blk, BLOCK_SIZE);
+    cb->dirty = true;
+    cb->logged = false;
+    if (write_through) {
+        return write_back(*cb);
+    }
+    return 0;
+}
+
+// reads count consecutive blocks into buf, uncached runs with one disk request.
+// The cached blocks are copied first, the runs are read without the lock.
+int
+BlockCache::readv(unsigned block_no, unsigned count, uint8_t *buf)
+{
+    std::vector<std::pair<unsigned, unsigned>> runs;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        unsigned run_start = 0;
+        for (unsigned i = 0; i <= count; i++) {
+            auto it = i < count ? blocks.find(block_no + i) : blocks.end();
+            if (i < count && it == blocks.end()) {
+                continue;
+            }
+            if (i > run_start) {
+                misses += i - run_start;
+                runs.push_back(std::make_pair(run_start, i - run_start));
+            }
+            if (i < count) {
+                use(*it->second);
+                std::memcpy(buf + (size_t)i * BLOCK_SIZE, it->second->data, BLOCK_SIZE);
+            }
+            run_start = i + 1;
+        }
+    }
+    for (auto &run : runs) {
+        if (disk.readv(block_no + run.first, run.second, buf + (size_t)run.first * BLOCK_SIZE)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// the count consecutive blocks inside the mapped disk file, see Disk::block_ptr
+const uint8_t *
+BlockCache::mapped(unsigned block_no, unsigned count)
+{
+    uint8_t *ptr = disk.block_ptr(block_no);
+    if (!ptr || count > disk.get_no_blocks() - block_no) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    for (unsigned i = 0; i < count; i++) {
+        auto it = blocks.find(block_no + i);
+        if (it != blocks.end() && it->second->dirty) {
+            return nullptr;
+        }
+    }
+    misses += count;
+    return ptr;
+}
+
+// reads the uncached blocks of count consecutive blocks into the cache
+int
+BlockCache::prefetch(unsigned block_no, unsigned count)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (block_no >= disk.get_no_blocks()) {
+        return 0;
+    }
+    count = std::min(count, disk.get_no_blocks() - block_no);
+    std::vector<uint8_t> buf;
+    unsigned run_start = 0;
+    for (unsigned i = 0; i <= count; i++) {
+        if (i < count && blocks.find(block_no + i) == blocks.end()) {
+            continue;
+        }
+        unsigned run = i - run_start;
+        if (run > 0) {
+            buf.resize((size_t)run * BLOCK_SIZE);
+            if (disk.readv(block_no + run_start, run, buf.data())) {
+                return -1;
+            }
+            for (unsigned j = 0; j < run; j++) {
+                cache_block *cb = insert(block_no + run_start + j);
+                if (!cb) {
+                    return -1;
+                }
+                std::memcpy(cb->data, buf.data() + (size_t)j * BLOCK_SIZE, BLOCK_SIZE);
+                cb->prefetched = true;
+            }
+            readahead_blocks += run;
+        }
+        run_start = i + 1;
+    }
+    return 0;
+}
+
+// writes count consecutive blocks to the disk and refreshes cached copies
+int
+BlockCache::writev(unsigned block_no, uint8_t **blks, unsigned count)
+{
+    // a block freed and reused since it was logged. Its old image must not
+    // be replayed over the new data.
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (journal && journal->active()) {
+            for (unsigned i = 0; i < count; i++) {
+                if (journal->is_logged(block_no + i)) {
+                    if (checkpoint()) {
+                        return -1;
+                    }
+                    break;
+                }
+            }
+            data_written = true;
+        }
+    }
+    if (disk.writev(block_no, blks, count)) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    for (unsigned i = 0; i < count; i++) {
+        auto it = blocks.find(block_no + i);
+        if (it != blocks.end()) {
+            std::memcpy(it->second->data, blks[i], BLOCK_SIZE);
+            it->second->dirty = false;
+        }
+    }
+    return 0;
+}
+
+// writes dirty blocks back to the disk, in block order and with one request
+// per run of consecutive blocks. Only the logged ones if logged_only is set.
+int
+BlockCache::write_dirty(bool logged_only)
+{
+    std::vector<cache_block*> dirty;
+    for (cache_block &cb : lru) {
+        if (cb.dirty && (cb.logged || !logged_only)) {
+            dirty.push_back(&cb);
+        }
+    }
+    std::sort(dirty.begin(), dirty.end(), [](const cache_block *a, const cache_block *b) {
+        return a->block_no < b->block_no;
+    });
+
+    int ret = 0;
+    size_t run_start = 0;
+    for (size_t i = 1; i <= dirty.size(); i++) {
+        if (i < dirty.size() && dirty[i]->block_no == dirty[i - 1]->block_no + 1) {
+            continue;
+        }
+        std::vector<uint8_t*> blks;
+        for (size_t j = run_start; j < i; j++) {
+            blks.push_back(dirty[j]->data);
+        }
+        if (disk.writev(dirty[run_start]->block_no, blks.data(), blks.size())) {
+            ret = -1;
+        } else {
+            for (size_t j = run_start; j < i; j++) {
+                dirty[j]->dirty = false;
+            }
+            writebacks += i - run_start;
+        }
+        run_start = i;
+    }
+    return ret;
+}
+
+// writes the logged blocks to their place, then empties the journal. A
+// block changed again since it was logged is not committed yet, so its
+// logged image goes to its place instead.
+int
+BlockCache::checkpoint()
+{
+    uint8_t image[BLOCK_SIZE];
+    for (cache_block &cb : lru) {
+        if (cb.dirty && !cb.logged && journal->is_logged(cb.block_no)) {
+            if (journal->read_logged(cb.block_no, image) || disk.write(cb.block_no, image)) {
+                return -1;
+            }
+        }
+    }
+    if (write_dirty(true) || disk.sync()) {
+        return -1;
+    }
+    return journal->checkpoint();
+}
+
+// logs the dirty blocks that are not in the journal yet as one transaction.
+// Data written with writev is flushed before, so a replayed transaction
+// never points at data that did not reach the disk.
+int
+BlockCache::commit()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return commit_blocks();
+}
+
+int
+BlockCache::commit_blocks()
+{
+    if (!journal || !journal->active()) {
+        return 0;
+    }
+    std::vector<cache_block*> dirty;
+    for (cache_block &cb : lru) {
+        if (cb.dirty && !cb.logged) {
+            dirty.push_back(&cb);
+        }
+    }
+    if (dirty.empty()) {
+        return 0;
+    }
+    std::sort(dirty.begin(), dirty.end(), [](const cache_block *a, const cache_block *b) {
+        return a->block_no < b->block_no;
+    });
+    if (!journal->fits(dirty.size()) && checkpoint()) {
+        return -1;
+    }
+    if (!journal->fits_empty(dirty.size())) {
+        // larger than the whole journal, written in place unprotected
+        if (write_dirty(false) || disk.sync()) {
+            return -1;
+        }
+        data_written = false;
+        return journal->checkpoint();
+    }
+    if (data_written && disk.sync()) {
+        return -1;
+    }
+    data_written = false;
+
+    std::vector<unsigned> block_nos;
+    std::vector<uint8_t*> images;
+    for (cache_block *cb : dirty) {
+        block_nos.push_back(cb->block_no);
+        images.push_back(cb->data);
+    }
+    if (journal->commit(block_nos, images)) {
+        return -1;
+    }
+    for (cache_block *cb : dirty) {
+        cb->logged = true;
+    }
+    return 0;
+}
+
+// writes all dirty blocks back to the disk
+int
+BlockCache::sync()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return sync_blocks();
+}
+
+int
+BlockCache::sync_blocks()
+{
+    if (!journal || !journal->active()) {
+        return write_dirty(false);
+    }
+    if (commit_blocks() || write_dirty(false) || disk.sync()) {
+        return -1;
+    }
+    data_written = false;
+    return journal->get_used() ? journal->checkpoint() : 0;
+}
+
+// drops every cached block without writing anything back
+void
+BlockCache::discard()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    blocks.clear();
+    lru.clear();
+}
+
+void
+BlockCache::set_capacity(unsigned new_capacity)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    capacity = new_capacity ? new_capacity : 1;
+    while (blocks.size() > capacity) {
+        if (evict()) {
+            break;
+        }
+    }
+}
+
+void
+BlockCache::set_write_through(bool enable)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    write_through = enable;
+    if (write_through) {
+        sync_blocks();
+    }
+}
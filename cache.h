@@ -0,0 +1,101 @@
+#include <iostream>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include "disk.h"
+#include "journal.h"
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#define CACHE_CAPACITY 64 // default number of blocks kept in the cache
+#define READAHEAD_WINDOW 16 // default largest number of blocks read ahead
+
+// write-back buffer cache between the file system and the disk. Blocks are
+// kept in LRU order, dirty blocks are written back when they are evicted or
+// when the cache is synced. With a journal, dirty blocks are committed to it
+// before they are written back, see commit(). Every call holds the cache
+// lock, except for the disk transfers of readv and writev.
+class BlockCache {
+private:
+    struct cache_block {
+        unsigned block_no;
+        bool dirty;
+        bool prefetched; // read ahead and not used yet
+        bool logged; // the data is in the journal
+        uint8_t data[BLOCK_SIZE];
+    };
+    Disk &disk;
+    std::mutex lock;
+    unsigned capacity;
+    // write every block straight through to the disk instead of keeping it dirty
+    bool write_through = false;
+    Journal *journal = nullptr;
+    // blocks were written with writev since the last commit
+    bool data_written = false;
+    // most recently used block first
+    std::list<cache_block> lru;
+    std::unordered_map<unsigned, std::list<cache_block>::iterator> blocks;
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    unsigned long writebacks = 0;
+    unsigned readahead_window = READAHEAD_WINDOW;
+    unsigned long readahead_blocks = 0;
+    unsigned long readahead_hits = 0;
+
+    cache_block *lookup(unsigned block_no);
+    void use(cache_block &cb);
+    cache_block *insert(unsigned block_no);
+    int write_back(cache_block &cb);
+    int write_dirty(bool logged_only);
+    int checkpoint();
+    int commit_blocks();
+    int sync_blocks();
+    int evict();
+public:
+    BlockCache(Disk &disk, unsigned capacity = CACHE_CAPACITY);
+    ~BlockCache();
+    // reads one block, from the cache if possible
+    int read(unsigned block_no, uint8_t *blk);
+    // writes one block into the cache, it reaches the disk later
+    int write(unsigned block_no, uint8_t *blk);
+    // bulk data transfers of count consecutive blocks. They go straight to
+    // the disk so large files do not flush out the metadata, but they see
+    // and update any copies already in the cache.
+    int readv(unsigned block_no, unsigned count, uint8_t *buf);
+    int writev(unsigned block_no, uint8_t **blks, unsigned count);
+    // the count consecutive blocks inside the mapped disk file, so they are
+    // read without a copy. nullptr unless the disk is mapped and none of
+    // them has a newer copy in the cache, they are read with readv then.
+    const uint8_t *mapped(unsigned block_no, unsigned count);
+    // reads the uncached blocks of count consecutive blocks into the cache,
+    // each run of them with one disk request, ahead of their use
+    int prefetch(unsigned block_no, unsigned count);
+    // logs the dirty blocks that are not in the journal yet as one
+    // transaction. Does nothing without a journal.
+    int commit();
+    // writes all dirty blocks back to the disk. With a journal they are
+    // committed first and the journal is emptied afterwards.
+    int sync();
+    // drops every cached block without writing anything back
+    void discard();
+    // the journal used for the blocks written with write(), nullptr for none
+    void set_journal(Journal *journal) { this->journal = journal; }
+    bool get_write_through() { return write_through; }
+    void set_write_through(bool enable);
+    unsigned get_capacity() { return capacity; }
+    void set_capacity(unsigned new_capacity);
+    unsigned long get_hits() { return hits; }
+    unsigned long get_misses() { return misses; }
+    unsigned long get_writebacks() { return writebacks; }
+    // largest number of blocks read ahead of a sequential reader, 0 turns
+    // readahead off. At most half the cache is used for it.
+    unsigned get_readahead_window() { return std::min(readahead_window, capacity / 2); }
+    void set_readahead_window(unsigned blocks) { readahead_window = blocks; }
+    unsigned long get_readahead_blocks() { return readahead_blocks; }
+    unsigned long get_readahead_hits() { return readahead_hits; }
+};
+
+#endif // __CACHE_H__
@@ -1,7 +1,8 @@
 struct dir_entry {
     char file_name[56]; // name of the file / sub-directory
     uint32_t size; // size of the file in bytes
-    uint16_t first_blk; // index in the FAT for the first block of the file
-    uint8_t type; // directory (1) or file (0)
-    uint8_t access_rights; // read (0x04), write (0x02), execute (0x01)
+    uint32_t first_blk : 27; // index in the FAT for the first block of the file
+    uint32_t type : 1; // directory (1) or file (0)
+    uint32_t access_rights : 3; // read (0x04), write (0x02), execute (0x01)
+    uint32_t inlined : 1; // the data is stored in the directory, see INLINE_MAX
 };
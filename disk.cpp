@@ -1,18 +1,91 @@
 #include <iostream>
+#include <cstring>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include "disk.h"
 
-Disk::Disk()
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// transfers a whole iovec array at offset, retrying after short transfers
+static int
+transfer_iov(int fd, struct iovec *iov, int iovcnt, off_t offset, bool do_write)
+{
+    while (iovcnt > 0) {
+        int cnt = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+        ssize_t n = do_write ? pwritev(fd, iov, cnt, offset) : preadv(fd, iov, cnt, offset);
+        if (n <= 0) {
+            return -1;
+        }
+        offset += n;
+        // skip the fully transferred buffers and advance into a partial one
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (n > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+Disk::Disk(int backend) : backend(backend)
 {
     // first check if the disk file exists, otherwise create it.
     if (!disk_file_exists(DISKNAME)) {
         std::cout << "No disk file found...\n";
         std::cout << "Creating disk file: " << DISKNAME << std::endl;
         std::ofstream f(DISKNAME, std::ios::binary | std::ios::out);
-        f.seekp((1<<23)-1);
+        f.seekp((uint64_t)DEFAULT_NO_BLOCKS * BLOCK_SIZE - 1);
         f.write("", 1);
     }
+    open_disk();
+}
+
+Disk::~Disk()
+{
+    close_disk();
+}
+
+// opens the disk file with the selected backend and reads its geometry
+void
+Disk::open_disk()
+{
+    fd = open(DISKNAME, O_RDWR);
+    if (fd == -1) {
+        std::cerr << "ERROR: Can't open diskfile: " << DISKNAME << ", exiting..."<< std::endl;
+        exit(-1);
+    }
+    struct stat st;
+    fstat(fd, &st);
+    no_blocks = st.st_size / BLOCK_SIZE;
+    disk_size = (uint64_t)no_blocks * BLOCK_SIZE;
+    if (backend == DISK_BACKEND_MMAP) {
+        // the disk is simulated as a binary file mapped into memory
+        void *addr = mmap(nullptr, disk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            std::cerr << "ERROR: Can't map diskfile: " << DISKNAME << ", exiting..."<< std::endl;
+            exit(-1);
+        }
+        map = (uint8_t*)addr;
+        return;
+    }
+    if (backend == DISK_BACKEND_PREAD) {
+        return;
+    }
     // the disk is simulated as a binary file
+    close(fd);
+    fd = -1;
     diskfile.open(DISKNAME, std::ios::in | std::ios::out | std::ios::binary);
     if (!diskfile.is_open()) {
         std::cerr << "ERROR: Can't open diskfile: " << DISKNAME << ", exiting..."<< std::endl;
@@ -20,11 +93,40 @@ Disk::Disk()
     }
 }
 
-Disk::~Disk()
+void
+Disk::close_disk()
 {
+    if (backend == DISK_BACKEND_MMAP) {
+        msync(map, disk_size, MS_SYNC);
+        munmap(map, disk_size);
+        map = nullptr;
+        close(fd);
+        return;
+    }
+    if (backend == DISK_BACKEND_PREAD) {
+        close(fd);
+        return;
+    }
     diskfile.close();
 }
 
+// grows or shrinks the disk file to no_blocks blocks
+int
+Disk::resize(unsigned no_blocks)
+{
+    if (no_blocks == this->no_blocks) {
+        return 0;
+    }
+    close_disk();
+    if (truncate(DISKNAME, (off_t)no_blocks * BLOCK_SIZE) == -1) {
+        std::cout << "Disk::resize - ERROR: Can't resize diskfile to " << no_blocks << " blocks\n";
+        open_disk();
+        return -1;
+    }
+    open_disk();
+    return 0;
+}
+
 bool
 Disk::disk_file_exists (const std::string& name) {
     std::ifstream f(name.c_str());
@@ -42,10 +144,20 @@ Disk::write(unsigned block_no, uint8_t *blk)
         std::cout << "Disk::write - ERROR: Invalid block number (" << block_no << ")\n";
         return -1;
     }
-    unsigned offset = block_no * BLOCK_SIZE;
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    if (backend == DISK_BACKEND_MMAP) {
+        std::memcpy(map + offset, blk, BLOCK_SIZE);
+        return flush_written(offset, BLOCK_SIZE);
+    }
+    if (backend == DISK_BACKEND_PREAD) {
+        struct iovec iov = { blk, BLOCK_SIZE };
+        return transfer_iov(fd, &iov, 1, offset, true);
+    }
+    std::lock_guard<std::mutex> guard(stream_lock);
     diskfile.seekp(offset, std::ios_base::beg);
     diskfile.write((char*)blk, BLOCK_SIZE);
-    diskfile.flush();
+    if (durability == DURABILITY_WRITE)
+        diskfile.flush();
     return 0;
 }
 
@@ -60,8 +172,190 @@ Disk:: read(unsigned block_no, uint8_t *blk)
         std::cout << "Disk::write - ERROR: Invalid block number (" << block_no << ")\n";
         return -1;
     }
-    unsigned offset = block_no * BLOCK_SIZE;
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    if (backend == DISK_BACKEND_MMAP) {
+        std::memcpy(blk, map + offset, BLOCK_SIZE);
+        return 0;
+    }
+    if (backend == DISK_BACKEND_PREAD) {
+        struct iovec iov = { blk, BLOCK_SIZE };
+        return transfer_iov(fd, &iov, 1, offset, false);
+    }
+    std::lock_guard<std::mutex> guard(stream_lock);
     diskfile.seekg(offset, std::ios_base::beg);
     diskfile.read((char*)blk, BLOCK_SIZE);
     return 0;
 }
+
+// reads count consecutive blocks, starting at block_no, into buf
+int
+Disk::readv(unsigned block_no, unsigned count, uint8_t *buf)
+{
+    if (DEBUG)
+        std::cout << "Disk::readv(" << block_no << ", " << count << ")\n";
+    if (block_no >= no_blocks || count > no_blocks - block_no) {
+        std::cout << "Disk::readv - ERROR: Invalid block range (" << block_no << ", " << count << ")\n";
+        return -1;
+    }
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    size_t len = (size_t)count * BLOCK_SIZE;
+    if (backend == DISK_BACKEND_MMAP) {
+        std::memcpy(buf, map + offset, len);
+        return 0;
+    }
+    if (backend == DISK_BACKEND_PREAD) {
+        struct iovec iov = { buf, len };
+        return transfer_iov(fd, &iov, 1, offset, false);
+    }
+    std::lock_guard<std::mutex> guard(stream_lock);
+    diskfile.seekg(offset, std::ios_base::beg);
+    diskfile.read((char*)buf, len);
+    return 0;
+}
+
+// reads count consecutive blocks, starting at block_no, one into each blks[i]
+int
+Disk::readv(unsigned block_no, uint8_t **blks, unsigned count)
+{
+    if (DEBUG)
+        std::cout << "Disk::readv(" << block_no << ", " << count << ")\n";
+    if (block_no >= no_blocks || count > no_blocks - block_no) {
+        std::cout << "Disk::readv - ERROR: Invalid block range (" << block_no << ", " << count << ")\n";
+        return -1;
+    }
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    if (backend == DISK_BACKEND_MMAP) {
+        for (unsigned i = 0; i < count; i++) {
+            std::memcpy(blks[i], map + offset + (size_t)i * BLOCK_SIZE, BLOCK_SIZE);
+        }
+        return 0;
+    }
+    if (backend == DISK_BACKEND_PREAD) {
+        std::vector<struct iovec> iov(count);
+        for (unsigned i = 0; i < count; i++) {
+            iov[i].iov_base = blks[i];
+            iov[i].iov_len = BLOCK_SIZE;
+        }
+        return transfer_iov(fd, iov.data(), count, offset, false);
+    }
+    std::lock_guard<std::mutex> guard(stream_lock);
+    // one seek, then the blocks follow each other in the file
+    diskfile.seekg(offset, std::ios_base::beg);
+    for (unsigned i = 0; i < count; i++) {
+        diskfile.read((char*)blks[i], BLOCK_SIZE);
+    }
+    return 0;
+}
+
+// writes count consecutive blocks, starting at block_no, from buf
+int
+Disk::writev(unsigned block_no, unsigned count, uint8_t *buf)
+{
+    if (DEBUG)
+        std::cout << "Disk::writev(" << block_no << ", " << count << ")\n";
+    if (block_no >= no_blocks || count > no_blocks - block_no) {
+        std::cout << "Disk::writev - ERROR: Invalid block range (" << block_no << ", " << count << ")\n";
+        return -1;
+    }
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    size_t len = (size_t)count * BLOCK_SIZE;
+    if (backend == DISK_BACKEND_MMAP) {
+        std::memcpy(map + offset, buf, len);
+        return flush_written(offset, len);
+    }
+    if (backend == DISK_BACKEND_PREAD) {
+        struct iovec iov = { buf, len };
+        return transfer_iov(fd, &iov, 1, offset, true);
+    }
+    std::lock_guard<std::mutex> guard(stream_lock);
+    diskfile.seekp(offset, std::ios_base::beg);
+    diskfile.write((char*)buf, len);
+    if (durability == DURABILITY_WRITE)
+        diskfile.flush();
+    return 0;
+}
+
+// writes count consecutive blocks, starting at block_no, one from each blks[i]
+int
+Disk::writev(unsigned block_no, uint8_t **blks, unsigned count)
+{
+    if (DEBUG)
+        std::cout << "Disk::writev(" << block_no << ", " << count << ")\n";
+    if (block_no >= no_blocks || count > no_blocks - block_no) {
+        std::cout << "Disk::writev - ERROR: Invalid block range (" << block_no << ", " << count << ")\n";
+        return -1;
+    }
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    if (backend == DISK_BACKEND_MMAP) {
+        for (unsigned i = 0; i < count; i++) {
+            std::memcpy(map + offset + (size_t)i * BLOCK_SIZE, blks[i], BLOCK_SIZE);
+        }
+        return flush_written(offset, (size_t)count * BLOCK_SIZE);
+    }
+    if (backend == DISK_BACKEND_PREAD) {
+        std::vector<struct iovec> iov(count);
+        for (unsigned i = 0; i < count; i++) {
+            iov[i].iov_base = blks[i];
+            iov[i].iov_len = BLOCK_SIZE;
+        }
+        return transfer_iov(fd, iov.data(), count, offset, true);
+    }
+    std::lock_guard<std::mutex> guard(stream_lock);
+    diskfile.seekp(offset, std::ios_base::beg);
+    for (unsigned i = 0; i < count; i++) {
+        diskfile.write((char*)blks[i], BLOCK_SIZE);
+    }
+    if (durability == DURABILITY_WRITE)
+        diskfile.flush();
+    return 0;
+}
+
+// returns a pointer to the block inside the mapped disk file
+uint8_t *
+Disk::block_ptr(unsigned block_no)
+{
+    if (backend != DISK_BACKEND_MMAP || block_no >= no_blocks) {
+        return nullptr;
+    }
+    return map + (size_t)block_no * BLOCK_SIZE;
+}
+
+// with DURABILITY_WRITE a write is flushed the way the stream backend flushes
+// it: the mapped pages just written are msynced. A pwrite is in the disk file
+// already, so the pread backend has nothing to do until sync().
+int
+Disk::flush_written(off_t offset, size_t len)
+{
+    if (durability != DURABILITY_WRITE || backend != DISK_BACKEND_MMAP) {
+        return 0;
+    }
+    off_t start = offset - offset % sysconf(_SC_PAGESIZE);
+    if (msync(map + start, offset + len - start, MS_SYNC) == -1) {
+        std::cout << "Disk::flush_written - ERROR: msync failed\n";
+        return -1;
+    }
+    return 0;
+}
+
+// forces all written blocks out to the disk file
+int
+Disk::sync()
+{
+    if (backend == DISK_BACKEND_MMAP) {
+        if (msync(map, disk_size, MS_SYNC) == -1) {
+            std::cout << "Disk::sync - ERROR: msync failed\n";
+            return -1;
+        }
+        return 0;
+    }
+    if (backend == DISK_BACKEND_PREAD) {
+        if (fsync(fd) == -1) {
+            std::cout << "Disk::sync - ERROR: fsync failed\n";
+            return -1;
+        }
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(stream_lock);
+    diskfile.flush();
+    return 0;
+}
@@ -1,28 +1,79 @@
 #include <iostream>
 #include <fstream>
+#include <cstdint>
+#include <mutex>
 
 #ifndef __DISK_H__
 #define __DISK_H__
 
 #define DISKNAME "diskfile.bin"
 #define BLOCK_SIZE 4096
+#define DEFAULT_NO_BLOCKS 2048 // size of a new disk file, 8 MiB
 #define DEBUG false
 
+// disk backends, selected when the Disk is constructed
+#define DISK_BACKEND_STREAM 0 // std::fstream, one seek + read/write per block
+#define DISK_BACKEND_MMAP 1 // the disk file is mapped into memory
+#define DISK_BACKEND_PREAD 2 // plain file descriptor, pread/pwrite and preadv/pwritev
+#ifndef DISK_BACKEND
+#define DISK_BACKEND DISK_BACKEND_STREAM // default backend
+#endif
+
+// durability levels, i.e., when written blocks are flushed to the disk file
+#define DURABILITY_WRITE 0 // after every block write
+#define DURABILITY_OP 1 // once per file system operation
+#define DURABILITY_SYNC 2 // on explicit sync, or when SYNC_INTERVAL has passed
+#ifndef DURABILITY
+#define DURABILITY DURABILITY_OP // default level
+#endif
+#define SYNC_INTERVAL 5 // seconds between flushes with DURABILITY_SYNC
+
 class Disk {
 private:
+    int backend;
+    int durability = DURABILITY;
     std::fstream diskfile;
-    const unsigned no_blocks = 2048;
-    const unsigned disk_size = BLOCK_SIZE * no_blocks;
+    // the stream has one position, so its requests take turns
+    std::mutex stream_lock;
+    // mmap and pread backends
+    int fd = -1;
+    uint8_t *map = nullptr;
+    // geometry, taken from the size of the disk file
+    unsigned no_blocks = 0;
+    uint64_t disk_size = 0;
     bool disk_file_exists (const std::string& name);
+    void open_disk();
+    void close_disk();
+    // flushes a write of len bytes at offset with DURABILITY_WRITE
+    int flush_written(off_t offset, size_t len);
 public:
-    Disk();
+    Disk(int backend = DISK_BACKEND);
     ~Disk();
     unsigned get_no_blocks() { return no_blocks; }
-    unsigned get_disk_size() { return disk_size; }
+    uint64_t get_disk_size() { return disk_size; }
+    // grows or shrinks the disk file to no_blocks blocks
+    int resize(unsigned no_blocks);
+    int get_backend() { return backend; }
+    int get_durability() { return durability; }
+    void set_durability(int level) { durability = level; }
     // writes one block to the disk
     int write(unsigned block_no, uint8_t *blk);
     // reads one block from the disk
     int read(unsigned block_no, uint8_t *blk);
+    // reads count consecutive blocks, starting at block_no, into buf
+    int readv(unsigned block_no, unsigned count, uint8_t *buf);
+    // reads count consecutive blocks, starting at block_no, one into each blks[i]
+    int readv(unsigned block_no, uint8_t **blks, unsigned count);
+    // writes count consecutive blocks, starting at block_no, from buf
+    int writev(unsigned block_no, unsigned count, uint8_t *buf);
+    // writes count consecutive blocks, starting at block_no, one from each blks[i]
+    int writev(unsigned block_no, uint8_t **blks, unsigned count);
+    // returns a pointer to the block inside the mapped disk file, so it can be
+    // read or modified without a copy. Only the mmap backend supports this,
+    // the stream backend returns nullptr.
+    uint8_t *block_ptr(unsigned block_no);
+    // forces all written blocks out to the disk file
+    int sync();
 };
 
 #endif // __DISK_H__
@@ -4,329 +4,1791 @@
 #include <sstream>
 #include <iomanip>
 #include <cmath>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cctype>
 #include <vector>
 #include <cstdint>
 #include "fs.h"
 
-#define FAT_EOF -1
+FS::FS(int disk_backend, unsigned cache_blocks) : disk(disk_backend), journal(disk), cache(disk, cache_blocks)
+{
+    // waiting writers go first, so a stream of readers cannot starve them
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&ns_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    cache.set_write_through(disk.get_durability() == DURABILITY_WRITE);
+    // handles stay where they are while an operation transfers data
+    handles.reserve(MAX_OPEN_FILES);
+    last_sync = std::chrono::steady_clock::now();
+
+    // a new or zeroed disk file has an all-zero superblock, it just waits
+    // for format. Anything else that does not mount is reported.
+    static const uint8_t zero[sizeof(sb)] = {0};
+    if (mount() && std::memcmp(&sb, zero, sizeof(sb)) != 0) {
+        // never formatted here, the disk may hold data of another version
+        std::cerr << "ERROR: no valid file system on " << DISKNAME << ", format it to use it" << std::endl;
+    }
+}
 
-FS::FS()
+FS::~FS()
 {
-    read_dir_from_disk(0);
+    if (!mounted) {
+        pthread_rwlock_destroy(&ns_lock);
+        return;
+    }
+    if (self().batching) {
+        commit_batch();
+    }
+    sync();
+    // the free count is only trusted by the next mount if this is reached
+    sb.clean = 1;
+    write_superblock();
+    cache.sync();
+    disk.sync();
+    pthread_rwlock_destroy(&ns_lock);
+}
 
-    uint8_t block2[BLOCK_SIZE] = {0};
+// returns the state of the calling thread, a new client starts in the root
+// directory
+struct fs_client &FS::self()
+{
+    std::lock_guard<std::mutex> guard(clients_lock);
+    auto it = clients.find(std::this_thread::get_id());
+    if (it == clients.end()) {
+        struct fs_client client = { sb.root_block, 0, OP_SHARED, false, {} };
+        it = clients.emplace(std::this_thread::get_id(), client).first;
+    }
+    return it->second;
+}
 
-    disk.read(1, block2);
+// takes the locks for the outermost operation of a client. An exclusive
+// operation or a change must not be started inside a shared one.
+void FS::begin_operation(int mode)
+{
+    struct fs_client &client = self();
+    if (client.op_depth++ > 0) {
+        return;
+    }
+    if (mode != OP_EXCLUSIVE) {
+        pthread_rwlock_rdlock(&ns_lock);
+        // written through, or without a journal, a block freed by a change
+        // is at once free on the disk, so changes run one at a time then
+        if (mode == OP_SHARED || (disk.get_durability() != DURABILITY_WRITE && journal.active())) {
+            client.mode = mode;
+            state_lock.lock();
+            return;
+        }
+        pthread_rwlock_unlock(&ns_lock);
+    }
+    client.mode = OP_EXCLUSIVE;
+    pthread_rwlock_wrlock(&ns_lock);
+}
 
-    std::memcpy(fat, block2, sizeof(fat));
+// locks the directories dirs for a change, besides those it holds already.
+// Waiting for a directory while holding another one could deadlock, so on
+// a busy directory all of them are released and taken again in block order,
+// with state_lock released meanwhile. Returns false then, the change must
+// look up its directories again. Nothing to lock outside of a change.
+bool FS::lock_dirs(std::vector<uint32_t> dirs)
+{
+    struct fs_client &client = self();
+    if (client.mode != OP_CHANGE) {
+        return true;
+    }
+    std::sort(dirs.begin(), dirs.end());
+    dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+    bool busy = false;
+    for (uint32_t dir : dirs) {
+        if (std::find(client.dirs.begin(), client.dirs.end(), dir) != client.dirs.end()) {
+            continue;
+        }
+        if (!dir_locks[dir].try_lock()) {
+            busy = true;
+            break;
+        }
+        client.dirs.push_back(dir);
+    }
+    if (!busy) {
+        return true;
+    }
+
+    dirs.insert(dirs.end(), client.dirs.begin(), client.dirs.end());
+    std::sort(dirs.begin(), dirs.end());
+    dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+    std::vector<std::mutex *> locks;
+    for (uint32_t dir : dirs) {
+        locks.push_back(&dir_locks[dir]);
+    }
+    unlock_dirs();
+    state_lock.unlock();
+    for (std::mutex *lock : locks) {
+        lock->lock();
+    }
+    state_lock.lock();
+    client.dirs = dirs;
+    return false;
 }
 
-FS::~FS()
+// releases the directories locked by the change of the calling client
+void FS::unlock_dirs()
+{
+    struct fs_client &client = self();
+    for (uint32_t dir : client.dirs) {
+        dir_locks[dir].unlock();
+    }
+    client.dirs.clear();
+}
+
+void FS::detach()
 {
-    while(current_working_block != 0){
-        cd("..");
+    std::lock_guard<std::mutex> guard(clients_lock);
+    auto it = clients.find(std::this_thread::get_id());
+    if (it != clients.end() && it->second.op_depth == 0) {
+        clients.erase(it);
     }
+}
 
-    write_dir_to_disk(0);
+uint32_t FS::get_cwd()
+{
+    return self().cwd;
 }
 
-int FS::find_empty_block()
+void FS::set_cwd(uint32_t dir)
 {
-    for (int i = 0; i < BLOCK_SIZE / 2; i++)
-    {
-        if (fat[i] == 0x0000)
-        {
-            return i;
+    self().cwd = dir;
+}
+
+// reads the superblock and sets up an empty, not yet loaded FAT. Only the
+// superblock is read, the FAT follows on demand. The journal is replayed
+// first, a disk without one is checked if it was not unmounted cleanly.
+int FS::mount()
+{
+    uint8_t block[BLOCK_SIZE] = {0};
+
+    mounted = false;
+    cache.set_journal(nullptr);
+    journal.close();
+    if (cache.read(SUPER_BLOCK, block)) {
+        return -1;
+    }
+    std::memcpy(&sb, block, sizeof(sb));
+
+    if (sb.magic != FS_MAGIC || sb.version != FS_VERSION || sb.block_size != BLOCK_SIZE
+            || sb.no_blocks != disk.get_no_blocks() || sb.fat_start != FAT_START
+            || (uint64_t)sb.fat_blocks * FAT_ENTRIES_PER_BLOCK < sb.no_blocks
+            || sb.root_block >= sb.no_blocks) {
+        return -1;
+    }
+    if (sb.journal_blocks) {
+        if (sb.journal_start < sb.fat_start + sb.fat_blocks
+                || sb.journal_start + sb.journal_blocks > sb.root_block) {
+            return -1;
+        }
+        int replayed = journal.open(sb.journal_start, sb.journal_blocks);
+        if (replayed < 0) {
+            return -1;
+        }
+        if (replayed > 0) {
+            // the superblock may have been replayed too
+            std::cout << "Replayed " << replayed << " transactions from the journal\n";
+            cache.discard();
+            cache.read(SUPER_BLOCK, block);
+            std::memcpy(&sb, block, sizeof(sb));
         }
+        cache.set_journal(&journal);
     }
-    return -1;
+
+    fat.assign((size_t)sb.fat_blocks * FAT_ENTRIES_PER_BLOCK, FAT_EOF);
+    fat_loaded.assign(sb.fat_blocks, false);
+    fat_dirty.assign(sb.fat_blocks, false);
+    fat_ra = readahead_state();
+    freemap.reset(sb.no_blocks);
+    freed.clear();
+    load_refcounts();
+
+    dir_indexes.clear();
+    dentries.clear();
+    block_maps.clear();
+    handles.clear();
+    dir_locks.clear();
+    reset_clients();
+
+    // mounted from now on, a crash leaves the disk marked as not clean
+    bool was_clean = sb.clean == 1;
+    sb.clean = 0;
+    write_superblock();
+    cache.sync();
+    disk.sync();
+    // with a journal the disk is consistent once it is replayed
+    if (!was_clean && !journal.active()) {
+        std::cout << "File system was not unmounted cleanly, checking it...\n";
+        check();
+    }
+    mounted = true;
+    return 0;
 }
 
-void FS::write_fat_to_disk()
+// walks a file or directory chain for check(), counting the references to
+// its blocks. Stops at a block that was seen before, the rest of the chain
+// has been counted then. Returns -1 if first_block is not a data block.
+int FS::check_chain(int first_block, std::vector<uint32_t> &refs)
 {
-    uint8_t block[BLOCK_SIZE] = {0};
+    int block = first_block;
+    if (block < (int)sb.root_block || block >= (int)sb.no_blocks) {
+        return -1;
+    }
+    while (block >= (int)sb.root_block && block < (int)sb.no_blocks) {
+        if (refs[block]++ > 0) {
+            break;
+        }
+        int next_block = get_fat(block);
+        if (next_block == FAT_FREE) {
+            // a chain ending in a free block, keep the block
+            set_fat(block, FAT_EOF);
+            break;
+        }
+        block = next_block;
+    }
+    return 0;
+}
+
+// scans the whole file system after an unclean unmount. Every block that is
+// reachable from the root directory is kept, all others are freed. The
+// reference counts of shared blocks and the free count are rebuilt.
+void FS::check()
+{
+    op_scope scope(this);
+    for (unsigned i = 0; i < sb.fat_blocks; i++) {
+        if (!fat_loaded[i]) {
+            load_fat_block(i);
+        }
+    }
 
-    std::memcpy(block, fat, sizeof(fat));
+    std::vector<uint32_t> refs(sb.no_blocks, 0);
+    std::vector<uint32_t> dirs(1, sb.root_block);
+    check_chain(sb.root_block, refs);
+    uint8_t block[BLOCK_SIZE];
+    while (!dirs.empty()) {
+        uint32_t dir = dirs.back();
+        dirs.pop_back();
+        for (int block_nr = dir; block_nr != FAT_EOF && block_nr != FAT_FREE; block_nr = get_fat(block_nr)) {
+            cache.read(block_nr, block);
+            struct dir_entry *entries = reinterpret_cast<struct dir_entry *>(block);
+            for (uint32_t i = 0; i < DIR_ENTRIES_PER_BLOCK; i++) {
+                struct dir_entry &entry = entries[i];
+                if (!entry.file_name[0] || entry.file_name[0] == INLINE_MARK
+                        || std::string(entry.file_name) == ".." || entry.inlined) {
+                    continue;
+                }
+                bool seen = entry.first_blk < sb.no_blocks && refs[entry.first_blk] > 0;
+                if (check_chain(entry.first_blk, refs) == 0 && entry.type == TYPE_DIR && !seen) {
+                    dirs.push_back(entry.first_blk);
+                }
+            }
+        }
+    }
 
-    disk.write(1, block);
+    // the shared block table is rebuilt from the counts, the old one is
+    // freed below with everything else that is not reachable
+    sb.refcount_block = 0;
+    shared_refs.clear();
+    for (uint32_t b = sb.root_block; b < sb.no_blocks; b++) {
+        if (refs[b] == 0 && get_fat(b) != FAT_FREE) {
+            set_fat(b, FAT_FREE);
+        } else if (refs[b] > 1) {
+            shared_refs[b] = refs[b];
+        }
+    }
+    refs_dirty = true;
+    sb.free_blocks = freemap.get_free_count();
+    write_superblock();
 }
 
-void FS::write_dir_to_disk(int block_nr)
+void FS::write_superblock()
 {
     uint8_t block[BLOCK_SIZE] = {0};
 
-    std::memcpy(block, dir_entries, sizeof(dir_entries));
+    std::memcpy(block, &sb, sizeof(sb));
+
+    cache.write(SUPER_BLOCK, block);
+    sb_dirty = false;
+}
 
-    disk.write(block_nr, block);
+// the end of the outermost operation of a client writes back what it changed
+// and releases the locks. Operations started from here only nest.
+void FS::end_operation()
+{
+    struct fs_client &client = self();
+    if (client.op_depth > 1) {
+        client.op_depth--;
+        return;
+    }
+    if (client.mode == OP_SHARED) {
+        client.op_depth = 0;
+        state_lock.unlock();
+        pthread_rwlock_unlock(&ns_lock);
+        return;
+    }
+    write_refcounts();
+    write_fat_to_disk();
+    if (sb_dirty) {
+        write_superblock();
+    }
+    if (client.mode == OP_CHANGE) {
+        // other changes may be half done, so only an exclusive operation
+        // commits, see wait_commit()
+        unsigned long seq = ++changes;
+        bool durable = disk.get_durability() == DURABILITY_OP
+                || std::chrono::steady_clock::now() - last_sync >= std::chrono::seconds(SYNC_INTERVAL);
+        unlock_dirs();
+        client.op_depth = 0;
+        state_lock.unlock();
+        pthread_rwlock_unlock(&ns_lock);
+        if (durable) {
+            wait_commit(seq);
+        }
+        return;
+    }
+    // drop the name indexes once there are too many, except for the current
+    // directories. Only done here, so no operation holds a stale reference.
+    if (dir_indexes.size() > DIR_INDEX_CACHE) {
+        std::set<uint32_t> cwds;
+        {
+            std::lock_guard<std::mutex> guard(clients_lock);
+            for (auto &c : clients) {
+                cwds.insert(c.second.cwd);
+            }
+        }
+        for (auto it = dir_indexes.begin(); it != dir_indexes.end();) {
+            if (cwds.count(it->first)) {
+                ++it;
+            } else {
+                it = dir_indexes.erase(it);
+            }
+        }
+    }
+    switch (disk.get_durability()) {
+    case DURABILITY_WRITE:
+        // every block has already been written through and flushed
+        reuse_freed();
+        break;
+    case DURABILITY_OP:
+        commit();
+        break;
+    case DURABILITY_SYNC:
+        if (std::chrono::steady_clock::now() - last_sync >= std::chrono::seconds(SYNC_INTERVAL)) {
+            commit();
+        }
+        break;
+    }
+    client.op_depth = 0;
+    pthread_rwlock_unlock(&ns_lock);
+}
+
+// waits until the change numbered seq is committed. The client that finds
+// no commit running commits with an empty exclusive operation, for itself
+// and every change that finished before it. One attempt each, a failed
+// commit is not retried forever.
+void FS::wait_commit(unsigned long seq)
+{
+    std::unique_lock<std::mutex> guard(commit_lock);
+    while (committed < seq) {
+        if (committing) {
+            commit_done.wait(guard);
+            continue;
+        }
+        committing = true;
+        guard.unlock();
+        {
+            op_scope scope(this);
+        }
+        guard.lock();
+        committing = false;
+        commit_done.notify_all();
+        return;
+    }
+}
+
+// moves every client back to the root directory, after format and mount
+void FS::reset_clients()
+{
+    std::lock_guard<std::mutex> guard(clients_lock);
+    for (auto &c : clients) {
+        c.second.cwd = sb.root_block;
+    }
+    generation++;
+}
+
+// makes the finished operations durable. With a journal their blocks are
+// committed to it as one group and written to their place later, without
+// one they are written back and flushed.
+int FS::commit()
+{
+    if (!journal.active()) {
+        return sync();
+    }
+    last_sync = std::chrono::steady_clock::now();
+    if (cache.commit()) {
+        return -1;
+    }
+    reuse_freed();
+    std::lock_guard<std::mutex> guard(commit_lock);
+    committed = changes;
+    return 0;
+}
+
+// the blocks freed by committed operations can be allocated again. Reused
+// any earlier, a crash would replay the old file over their new data.
+void FS::reuse_freed()
+{
+    for (unsigned block : freed) {
+        if (fat[block] == FAT_FREE) {
+            freemap.set_free(block);
+        }
+    }
+    freed.clear();
+}
+
+int FS::find_empty_block()
+{
+    if (ensure_free_blocks(1)) {
+        return -1;
+    }
+    return freemap.find();
 }
 
-void FS::read_dir_from_disk(int block_nr)
+// reads one FAT block from the disk and adds its free blocks to the free map
+void FS::load_fat_block(unsigned fat_block)
 {
     uint8_t block[BLOCK_SIZE] = {0};
 
-    disk.read(block_nr, block);
+    // FAT blocks loaded one after the other are read ahead in one request,
+    // up to the next one that is loaded already
+    unsigned from, to;
+    if (readahead(fat_ra, fat_block, fat_block, sb.fat_blocks, from, to)) {
+        for (unsigned i = from; i < to; i++) {
+            if (fat_loaded[i]) {
+                to = i;
+            }
+        }
+        if (from < to) {
+            cache.prefetch(sb.fat_start + from, to - from);
+        }
+    }
 
-    std::memcpy(dir_entries, block, sizeof(dir_entries));
+    cache.read(sb.fat_start + fat_block, block);
+
+    size_t first = (size_t)fat_block * FAT_ENTRIES_PER_BLOCK;
+    std::memcpy(&fat[first], block, BLOCK_SIZE);
+    fat_loaded[fat_block] = true;
+
+    for (size_t i = first; i < first + FAT_ENTRIES_PER_BLOCK && i < sb.no_blocks; i++) {
+        if (fat[i] == FAT_FREE) {
+            freemap.set_free(i);
+        }
+    }
 }
 
-int FS::move_to_path(std::string path_to_move){
-    std::vector<std::string> dirs; 
-    std::stringstream ss(path_to_move);
-    std::string part;
-    int block_to_return;
+int32_t FS::get_fat(unsigned block)
+{
+    if (!fat_loaded[block / FAT_ENTRIES_PER_BLOCK]) {
+        load_fat_block(block / FAT_ENTRIES_PER_BLOCK);
+    }
+    return fat[block];
+}
 
-    write_dir_to_disk(current_working_block);
+// updates one FAT entry and keeps the free map in step with it
+void FS::set_fat(unsigned block, int32_t value)
+{
+    int32_t old_value = get_fat(block);
+    if (old_value == value) {
+        return;
+    }
+    if (old_value == FAT_FREE) {
+        sb.free_blocks--;
+        sb_dirty = true;
+    } else if (value == FAT_FREE) {
+        sb.free_blocks++;
+        sb_dirty = true;
+    }
+    fat[block] = value;
+    fat_dirty[block / FAT_ENTRIES_PER_BLOCK] = true;
+    if (value == FAT_FREE && journal.active()) {
+        // still in use until the transaction that frees it is committed,
+        // see reuse_freed()
+        freed.push_back(block);
+    } else if (value == FAT_FREE) {
+        freemap.set_free(block);
+    } else {
+        freemap.set_used(block);
+    }
+}
 
-    while(std::getline(ss, part, '/')){
-        if(!part.empty()){
-            dirs.push_back(part);
+// loads FAT blocks until the free map knows of at least count free blocks
+int FS::ensure_free_blocks(unsigned count)
+{
+    // the superblock knows without loading any FAT block
+    if (sb.free_blocks < count) {
+        return -1;
+    }
+    for (unsigned i = 0; i < fat_loaded.size() && freemap.get_free_count() < count; i++) {
+        if (!fat_loaded[i]) {
+            load_fat_block(i);
         }
     }
+    return freemap.get_free_count() < count ? -1 : 0;
+}
 
-    if(path_to_move.at(0) == '/'){
-        read_dir_from_disk(0);
+// writes the FAT blocks that changed since the last call, once per operation
+void FS::write_fat_to_disk()
+{
+    for (unsigned i = 0; i < fat_dirty.size(); i++) {
+        if (!fat_dirty[i]) {
+            continue;
+        }
+        cache.write(sb.fat_start + i, reinterpret_cast<uint8_t *>(&fat[(size_t)i * FAT_ENTRIES_PER_BLOCK]));
+        fat_dirty[i] = false;
     }
+}
 
-    for(std::string dir : dirs){
-        int found = 0;
-        for (const struct dir_entry var : dir_entries) {
-            if (std::string(var.file_name) == dir && var.type == 1) {
-                found = 1;
-                block_to_return = var.first_blk;
-                read_dir_from_disk(var.first_blk);
-                break;
+// allocates count blocks in as few extents as possible, see FreeMap::alloc_extents
+int FS::alloc_blocks(unsigned count, std::vector<int> &blocks, int goal)
+{
+    if (ensure_free_blocks(count)) {
+        return -1;
+    }
+    // the goal block is only known to be free once its FAT block is loaded
+    if (goal >= 0 && (unsigned)goal < sb.no_blocks) {
+        get_fat(goal);
+    }
+    std::vector<struct extent> extents;
+    if (freemap.alloc_extents(count, extents, goal)) {
+        return -1;
+    }
+    for (const struct extent &e : extents) {
+        for (unsigned b = e.start; b < e.start + e.count; b++) {
+            blocks.push_back(b);
+        }
+    }
+    return 0;
+}
+
+// frees every block of the chain starting at first_block. Freeing stops at
+// the first shared block, the rest of the chain still has another owner.
+void FS::free_chain(int first_block)
+{
+    drop_block_map(first_block);
+    int block = first_block;
+    while (block != FAT_EOF && block != FAT_FREE) {
+        auto shared = shared_refs.find(block);
+        if (shared != shared_refs.end()) {
+            if (--shared->second <= 1) {
+                shared_refs.erase(shared);
             }
+            refs_dirty = true;
+            return;
+        }
+        int next_block = get_fat(block);
+        set_fat(block, FAT_FREE);
+        block = next_block;
+    }
+}
+
+// reads the shared block table saved by write_refcounts
+void FS::load_refcounts()
+{
+    shared_refs.clear();
+    refs_dirty = false;
+    if (sb.refcount_block == 0 || sb.refcount_block >= sb.no_blocks) {
+        return;
+    }
+    uint8_t block[BLOCK_SIZE];
+    cache.read(sb.refcount_block, block);
+    uint32_t count;
+    std::memcpy(&count, block, sizeof(count));
+
+    std::string data;
+    read_chain(sb.refcount_block, sizeof(uint32_t) * (1 + 2 * (uint64_t)count), data);
+    const uint32_t *table = reinterpret_cast<const uint32_t *>(data.data());
+    for (uint32_t i = 0; i < count && 2 * (size_t)i + 2 < data.size() / sizeof(uint32_t); i++) {
+        if (table[1 + 2 * i] < sb.no_blocks && table[2 + 2 * i] > 1) {
+            shared_refs[table[1 + 2 * i]] = table[2 + 2 * i];
         }
-        if(found == 0){
-            read_dir_from_disk(current_working_block);
+    }
+}
+
+// saves the shared block table in a new chain if it changed, once per operation
+int FS::write_refcounts()
+{
+    if (!refs_dirty) {
+        return 0;
+    }
+    refs_dirty = false;
+    if (sb.refcount_block) {
+        free_chain(sb.refcount_block);
+        sb.refcount_block = 0;
+    }
+    int ret = 0;
+    if (!shared_refs.empty()) {
+        std::vector<uint32_t> table;
+        table.push_back(shared_refs.size());
+        for (const auto &ref : shared_refs) {
+            table.push_back(ref.first);
+            table.push_back(ref.second);
+        }
+        // the table belongs to no directory, so nobody else may save it meanwhile
+        int first_block = write_data_to_disk(std::string(reinterpret_cast<char *>(table.data()), table.size() * sizeof(uint32_t)), -1, true);
+        if (first_block == -1) {
+            // out of space, the sharing is lost when the disk is mounted again
+            ret = -1;
+        } else {
+            sb.refcount_block = first_block;
+        }
+    }
+    write_superblock();
+    return ret;
+}
+
+// adds one reference to a block
+void FS::add_ref(int block)
+{
+    auto shared = shared_refs.find(block);
+    if (shared == shared_refs.end()) {
+        shared_refs[block] = 2;
+    } else {
+        shared->second++;
+    }
+    refs_dirty = true;
+}
+
+// gives the file entry its own copy of the blocks 0 to index of its chain,
+// so they can be changed in place. Only the blocks from the first shared
+// one are copied, the copy of block index links back into the shared rest
+// of the chain. entry.first_blk is updated when the first block is copied.
+int FS::unshare_chain(struct dir_entry &entry, unsigned index)
+{
+    if (shared_refs.empty()) {
+        return 0;
+    }
+    std::vector<int> path;
+    int block = entry.first_blk;
+    unsigned first_shared = index + 1;
+    while (path.size() <= index && block != FAT_EOF && block != FAT_FREE) {
+        if (first_shared > index && shared_refs.count(block)) {
+            first_shared = path.size();
+        }
+        path.push_back(block);
+        block = get_fat(block);
+    }
+    if (first_shared > index || path.size() <= index) {
+        return 0;
+    }
+    drop_block_map(entry.first_blk);
+
+    unsigned count = index - first_shared + 1;
+    std::vector<int> copies;
+    if (alloc_blocks(count, copies)) {
+        return -1;
+    }
+    uint8_t data[BLOCK_SIZE];
+    uint8_t *blk = data;
+    for (unsigned i = 0; i < count; i++) {
+        if (cache.readv(path[first_shared + i], 1, data) || cache.writev(copies[i], &blk, 1)) {
+            // the chain still uses the shared blocks, the copies go back
+            release_blocks(copies);
             return -1;
         }
     }
-    return block_to_return;
+    for (unsigned i = 0; i < count; i++) {
+        set_fat(copies[i], i + 1 < count ? copies[i + 1] : block);
+    }
+    if (block != FAT_EOF && block != FAT_FREE) {
+        add_ref(block);
+    }
+
+    // the copy replaces one reference to the first shared block
+    auto shared = shared_refs.find(path[first_shared]);
+    if (--shared->second <= 1) {
+        shared_refs.erase(shared);
+    }
+    refs_dirty = true;
+    if (first_shared == 0) {
+        entry.first_blk = copies[0];
+    } else {
+        set_fat(path[first_shared - 1], copies[0]);
+    }
+    return 0;
 }
 
-int
-FS::check_name_exists(std::string filename){
-    int block_to_enter = 1;
-    for(struct dir_entry var : dir_entries){
-        if(std::string(var.file_name) == filename){
-            if(var.type == 1){
-                block_to_enter = var.first_blk;
-                break;
+// returns the name index of a directory, scanning the directory once if it
+// is not indexed yet
+struct dir_index &FS::get_dir_index(uint32_t dir)
+{
+    auto it = dir_indexes.find(dir);
+    if (it != dir_indexes.end()) {
+        return it->second;
+    }
+
+    struct dir_index &index = dir_indexes[dir];
+    uint8_t block[BLOCK_SIZE];
+    int block_nr = dir;
+    while (block_nr != FAT_EOF && block_nr != FAT_FREE) {
+        uint32_t first_pos = index.blocks.size() * DIR_ENTRIES_PER_BLOCK;
+        index.blocks.push_back(block_nr);
+        cache.read(block_nr, block);
+        struct dir_entry *entries = reinterpret_cast<struct dir_entry *>(block);
+        for (uint32_t i = 0; i < DIR_ENTRIES_PER_BLOCK; i++) {
+            if (!entries[i].file_name[0]) {
+                index.free_slots.insert(first_pos + i);
+                continue;
             }
-            else {
-                block_to_enter = -1;
-                break;
+            if (entries[i].file_name[0] == INLINE_MARK) {
+                continue;
+            }
+            std::string name(entries[i].file_name, strnlen(entries[i].file_name, sizeof(entries[i].file_name)));
+            index.names[name] = first_pos + i;
+            if (entries[i].type == TYPE_DIR && name != "..") {
+                index.subdirs[entries[i].first_blk] = first_pos + i;
             }
         }
-    } 
-    return block_to_enter;
+        block_nr = get_fat(block_nr);
+    }
+    return index;
+}
+
+struct dir_slot FS::get_slot(struct dir_index &index, uint32_t pos)
+{
+    struct dir_slot slot;
+    slot.block = index.blocks[pos / DIR_ENTRIES_PER_BLOCK];
+    slot.index = pos % DIR_ENTRIES_PER_BLOCK;
+    return slot;
+}
+
+void FS::read_entry(struct dir_slot slot, struct dir_entry &entry)
+{
+    uint8_t block[BLOCK_SIZE];
+
+    cache.read(slot.block, block);
+
+    std::memcpy(&entry, block + slot.index * sizeof(struct dir_entry), sizeof(entry));
+}
+
+void FS::write_entry(struct dir_slot slot, const struct dir_entry &entry)
+{
+    uint8_t block[BLOCK_SIZE];
+
+    cache.read(slot.block, block);
+    std::memcpy(block + slot.index * sizeof(struct dir_entry), &entry, sizeof(entry));
+
+    cache.write(slot.block, block);
+}
+
+// looks up name in the directory dir, returns -1 if there is no such entry
+int FS::dir_lookup(uint32_t dir, std::string name, struct dir_entry &entry, struct dir_slot *slot)
+{
+    struct dentry_key key = { dir, name };
+    auto cached = dentries.find(key);
+    if (cached != dentries.end()) {
+        entry = cached->second.entry;
+        if (slot) {
+            *slot = cached->second.slot;
+        }
+        return 0;
+    }
+
+    struct dir_index &index = get_dir_index(dir);
+    auto it = index.names.find(name);
+    if (it == index.names.end()) {
+        return -1;
+    }
+    struct dir_slot found = get_slot(index, it->second);
+    read_entry(found, entry);
+    dentry_insert(dir, name, entry, found);
+    if (slot) {
+        *slot = found;
+    }
+    return 0;
+}
+
+// remembers a lookup result, the whole cache is dropped when it is full
+void FS::dentry_insert(uint32_t dir, std::string name, const struct dir_entry &entry, struct dir_slot slot)
+{
+    if (dentries.size() >= DENTRY_CACHE) {
+        dentries.clear();
+    }
+    struct dentry_key key = { dir, name };
+    struct dentry &cached = dentries[key];
+    cached.entry = entry;
+    cached.slot = slot;
+}
+
+// writes a changed entry of the directory dir, keeping the dentry cache in step
+void FS::dir_update(uint32_t dir, struct dir_slot slot, const struct dir_entry &entry)
+{
+    write_entry(slot, entry);
+    struct dentry_key key = { dir, std::string(entry.file_name) };
+    auto cached = dentries.find(key);
+    if (cached != dentries.end()) {
+        cached->second.entry = entry;
+    }
+    // open handles see the new size and chain
+    for (struct open_file &h : handles) {
+        if (h.used && h.slot.block == slot.block && h.slot.index == slot.index) {
+            h.entry = entry;
+        }
+    }
+}
+
+// returns the open handle fd, nullptr if there is none
+struct open_file *FS::get_handle(int fd)
+{
+    if (fd < 0 || (size_t)fd >= handles.size() || !handles[fd].used) {
+        return nullptr;
+    }
+    return &handles[fd];
 }
 
-bool 
-FS::check_permissions(uint8_t permissions, uint16_t block, bool is_dir){
-    std::cout << ""; // DO NOT REMOVE, DOES NOT WORK WITHOUT. Most likely compiler optimization side effects.
-    if(block != 0){
-        bool allowed = false;
-        if(is_dir){
-            write_dir_to_disk(block);
-            read_dir_from_disk(dir_entries[0].first_blk);
+// returns whether the entry stored at slot is open
+bool FS::is_open(struct dir_slot slot)
+{
+    for (struct open_file &h : handles) {
+        if (h.used && h.slot.block == slot.block && h.slot.index == slot.index) {
+            return true;
         }
-        for(struct dir_entry var : dir_entries) {
-            if(var.first_blk == block){
-                allowed = permissions & var.access_rights;
+    }
+    return false;
+}
+
+// adds an entry to the directory dir, growing the directory if it is full.
+// The data of an inlined file goes into the slots after the entry.
+int FS::dir_add(uint32_t dir, const struct dir_entry &entry, const std::string &data)
+{
+    struct dir_index &index = get_dir_index(dir);
+    std::string name(entry.file_name);
+    if (index.names.count(name)) {
+        return -1;
+    }
+    unsigned data_slots = entry.inlined ? (entry.size + INLINE_SLOT_DATA - 1) / INLINE_SLOT_DATA : 0;
+
+    // the lowest run of free slots that fits, all in one block
+    uint32_t pos = 0;
+    unsigned run = 0;
+    for (;;) {
+        uint32_t prev = 0;
+        for (uint32_t free_pos : index.free_slots) {
+            if (run == 0 || free_pos != prev + 1 || free_pos % DIR_ENTRIES_PER_BLOCK == 0) {
+                pos = free_pos;
+                run = 0;
+            }
+            prev = free_pos;
+            if (++run > data_slots) {
                 break;
             }
         }
-        if(is_dir){
-            read_dir_from_disk(block);
+        if (run > data_slots) {
+            break;
         }
-        return allowed;
-    } else {
-        return true;
+        if (dir_grow(index)) {
+            return -1;
+        }
+        run = 0;
+    }
+
+    struct dir_slot slot = get_slot(index, pos);
+    uint8_t block[BLOCK_SIZE];
+    cache.read(slot.block, block);
+    std::memcpy(block + slot.index * sizeof(struct dir_entry), &entry, sizeof(entry));
+    for (unsigned i = 0; i < data_slots; i++) {
+        uint8_t *cont = block + (slot.index + 1 + i) * sizeof(struct dir_entry);
+        size_t len = std::min((size_t)INLINE_SLOT_DATA, data.size() - i * INLINE_SLOT_DATA);
+        std::memset(cont, 0, sizeof(struct dir_entry));
+        cont[0] = INLINE_MARK;
+        std::memcpy(cont + 1, data.data() + i * INLINE_SLOT_DATA, len);
+    }
+    cache.write(slot.block, block);
+    for (unsigned i = 0; i <= data_slots; i++) {
+        index.free_slots.erase(pos + i);
     }
+    dentry_insert(dir, name, entry, slot);
+    index.names[name] = pos;
+    if (entry.type == TYPE_DIR && name != "..") {
+        index.subdirs[entry.first_blk] = pos;
+    }
+    return 0;
 }
 
-int 
-FS::write_data_to_disk(std::string data){
-    size_t data_size = data.size();
-    int current_index = 0;
-    int num_blocks = std::ceil((double)data_size / BLOCK_SIZE);
-    int empty_index = find_empty_block();
-    int last_empty_index = -1;
-    int first_block = empty_index;
-    
-    for(int i = 0; i < num_blocks; i++){
-        std::vector<char> block(BLOCK_SIZE, 0);
-    
-        if (empty_index == -1) {
+// removes the entry name from the directory dir
+int FS::dir_remove(uint32_t dir, std::string name)
+{
+    struct dir_index &index = get_dir_index(dir);
+    auto it = index.names.find(name);
+    if (it == index.names.end()) {
+        return -1;
+    }
+    uint32_t pos = it->second;
+    struct dir_slot slot = get_slot(index, pos);
+    struct dir_entry entry;
+    read_entry(slot, entry);
+    if (entry.type == TYPE_DIR) {
+        index.subdirs.erase(entry.first_blk);
+    }
+    unsigned data_slots = entry.inlined ? (entry.size + INLINE_SLOT_DATA - 1) / INLINE_SLOT_DATA : 0;
+    uint8_t block[BLOCK_SIZE];
+    cache.read(slot.block, block);
+    std::memset(block + slot.index * sizeof(struct dir_entry), 0, (1 + data_slots) * sizeof(struct dir_entry));
+    cache.write(slot.block, block);
+    dentries.erase(dentry_key{ dir, name });
+    index.names.erase(it);
+    for (unsigned i = 0; i <= data_slots; i++) {
+        index.free_slots.insert(pos + i);
+    }
+    return 0;
+}
+
+// returns whether name can be used for a new file or directory
+bool FS::valid_name(std::string name)
+{
+    return !name.empty() && name.length() < sizeof(((struct dir_entry *)0)->file_name)
+        && name != "." && name != ".." && name[0] != INLINE_MARK;
+}
+
+// reads the data of an inlined file, stored after its entry at slot
+int FS::read_inline(struct dir_slot slot, const struct dir_entry &entry, std::string &data)
+{
+    uint8_t block[BLOCK_SIZE];
+    cache.read(slot.block, block);
+    data.clear();
+    for (unsigned i = 0; data.size() < entry.size; i++) {
+        uint8_t *cont = block + (slot.index + 1 + i) * sizeof(struct dir_entry);
+        if (slot.index + 1 + i >= DIR_ENTRIES_PER_BLOCK || cont[0] != INLINE_MARK) {
             return -1;
         }
+        size_t len = std::min((size_t)INLINE_SLOT_DATA, entry.size - data.size());
+        data.append(reinterpret_cast<char *>(cont + 1), len);
+    }
+    return 0;
+}
 
-        last_empty_index = empty_index;
-        if(i == num_blocks - 1){
-            fat[empty_index] = FAT_EOF;
-        } else {
-            fat[last_empty_index] = empty_index + 1;
-        }
-        
-        size_t remaining_data_size = data_size - current_index;
-        size_t copy_size = std::min(remaining_data_size, (size_t)BLOCK_SIZE);
+// moves the data of an inlined file into a block chain, so it can grow and
+// be changed like any other file. The data slots are freed.
+int FS::promote_inline(uint32_t parent, struct dir_slot slot, struct dir_entry &entry)
+{
+    if (!entry.inlined) {
+        return 0;
+    }
+    std::string data;
+    if (read_inline(slot, entry, data)) {
+        return -1;
+    }
+    int first_block = write_data_to_disk(data);
+    if (first_block == -1) {
+        return -1;
+    }
 
-        std::memcpy(block.data(), data.c_str() + current_index, copy_size);
-        disk.write(empty_index, reinterpret_cast<uint8_t*>(block.data()));
-        write_fat_to_disk();
-        current_index += copy_size;
-        empty_index = find_empty_block();
+    struct dir_index &index = get_dir_index(parent);
+    unsigned data_slots = (entry.size + INLINE_SLOT_DATA - 1) / INLINE_SLOT_DATA;
+    uint8_t block[BLOCK_SIZE];
+    cache.read(slot.block, block);
+    std::memset(block + (slot.index + 1) * sizeof(struct dir_entry), 0, data_slots * sizeof(struct dir_entry));
+    cache.write(slot.block, block);
+    auto it = index.names.find(std::string(entry.file_name));
+    if (it != index.names.end()) {
+        for (unsigned i = 1; i <= data_slots; i++) {
+            index.free_slots.insert(it->second + i);
+        }
     }
 
-    return first_block;
+    entry.first_blk = first_block;
+    entry.inlined = 0;
+    dir_update(parent, slot, entry);
+    return 0;
 }
 
-int
-FS::create_file(std::string data, std::string filepath, std::string og_name = "", uint8_t permissions = 0x6){
-    bool isSpace = false;
-    std::string filename = filepath;
-    int block_to_return = current_working_block;
-    std::size_t pos;
-
-    if(filepath != "/"){
-        pos = filepath.find_last_of("/");
-        if(pos != std::string::npos){
-            filename = filepath.substr(pos + 1);
-            filepath.erase(pos);
-            if(filepath == ""){
-                filepath = "/";
+// links one more (empty) block to the end of the directory of index
+int FS::dir_grow(struct dir_index &index)
+{
+    std::vector<int> blocks;
+    uint32_t last_block = index.blocks.back();
+    if (alloc_blocks(1, blocks, last_block + 1)) {
+        return -1;
+    }
+    uint8_t block[BLOCK_SIZE] = {0};
+    cache.write(blocks[0], block);
+    set_fat(last_block, blocks[0]);
+    set_fat(blocks[0], FAT_EOF);
+
+    uint32_t first_pos = index.blocks.size() * DIR_ENTRIES_PER_BLOCK;
+    index.blocks.push_back(blocks[0]);
+    for (uint32_t i = 0; i < DIR_ENTRIES_PER_BLOCK; i++) {
+        index.free_slots.insert(first_pos + i);
+    }
+    return 0;
+}
+
+// returns all used entries of the directory dir, in the order they are stored
+void FS::dir_list(uint32_t dir, std::vector<struct dir_entry> &entries)
+{
+    uint8_t block[BLOCK_SIZE];
+    struct dir_index &index = get_dir_index(dir);
+    for (uint32_t block_nr : index.blocks) {
+        cache.read(block_nr, block);
+        struct dir_entry *dir_entries = reinterpret_cast<struct dir_entry *>(block);
+        for (uint32_t i = 0; i < DIR_ENTRIES_PER_BLOCK; i++) {
+            if (dir_entries[i].file_name[0] && dir_entries[i].file_name[0] != INLINE_MARK) {
+                entries.push_back(dir_entries[i]);
             }
-            block_to_return = move_to_path(filepath);
-        }
-        int check_file = check_name_exists(filename);
-        if(og_name != "" && check_file != 1){
-            block_to_return = check_file;
-            read_dir_from_disk(block_to_return);
-            filename = og_name;
-        } else if(check_file == -1){
+        }
+    }
+}
+
+// returns the access rights of the directory dir, as stored in its parent
+uint8_t FS::dir_rights(uint32_t dir)
+{
+    if (dir == sb.root_block) {
+        return READ | WRITE | EXECUTE;
+    }
+    struct dir_entry parent;
+    if (dir_lookup(dir, "..", parent)) {
+        return 0;
+    }
+    struct dir_index &index = get_dir_index(parent.first_blk);
+    auto it = index.subdirs.find(dir);
+    if (it == index.subdirs.end()) {
+        return 0;
+    }
+    struct dir_entry entry;
+    read_entry(get_slot(index, it->second), entry);
+    return entry.access_rights;
+}
+
+// resolves a path to a directory, relative to the current directory unless
+// it starts with '/'. Returns -1 if a component is missing or not a directory.
+int FS::resolve_dir(std::string path, uint32_t &dir)
+{
+    if (!mounted) {
+        return -1;
+    }
+    dir = (!path.empty() && path[0] == '/') ? sb.root_block : self().cwd;
+    std::size_t start = 0;
+    while (start < path.size()) {
+        std::size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        std::string part = path.substr(start, end - start);
+        start = end + 1;
+        if (part.empty() || part == ".") {
+            continue;
+        }
+        struct dir_entry entry;
+        if (dir_lookup(dir, part, entry) || entry.type != TYPE_DIR) {
             return -1;
         }
-    } else {
-        read_dir_from_disk(block_to_return);
+        dir = entry.first_blk;
     }
+    return 0;
+}
 
-    if(!check_permissions(2, block_to_return, 1)){
+// resolves the directory that holds the last component of path, and
+// returns that component in name
+int FS::resolve_parent(std::string path, uint32_t &parent, std::string &name)
+{
+    if (!mounted) {
         return -1;
-    };
+    }
+    std::size_t pos = path.find_last_of("/");
+    if (pos == std::string::npos) {
+        parent = self().cwd;
+        name = path;
+        return 0;
+    }
+    name = path.substr(pos + 1);
+    path.erase(pos);
+    if (path == "") {
+        path = "/";
+    }
+    return resolve_dir(path, parent);
+}
 
-    if (filename.length() >= 56)
-    {
+// resolves where cp and mv put sourcepath: into destpath if that is a
+// directory, otherwise as the new name destpath. Fails if the target exists.
+int FS::resolve_target(std::string sourcepath, std::string destpath, uint32_t &parent, std::string &name)
+{
+    if (resolve_dir(destpath, parent) == 0) {
+        std::size_t pos = sourcepath.find_last_of("/");
+        name = pos == std::string::npos ? sourcepath : sourcepath.substr(pos + 1);
+    } else if (resolve_parent(destpath, parent, name)) {
+        return -1;
+    }
+    struct dir_entry entry;
+    if (!valid_name(name)) {
         return -1;
     }
+    if (dir_lookup(parent, name, entry) == 0) {
+        return -1;
+    }
+    return 0;
+}
 
-    for (struct dir_entry var : dir_entries)
+int 
+FS::write_data_to_disk(std::string data, int goal, bool locked){
+    std::vector<int> blocks;
+
+    if(write_data_blocks(data, blocks, goal, locked)){
+        return -1;
+    }
+    return link_blocks(blocks);
+}
+
+// allocates blocks for data and writes it to them, without linking them in
+// the FAT. An operation that is not exclusive writes with the other clients
+// let in, unless locked.
+int
+FS::write_data_blocks(const std::string &data, std::vector<int> &blocks, int goal, bool locked){
+    size_t data_size = data.size();
+    int num_blocks = std::ceil((double)data_size / BLOCK_SIZE);
+
+    // an empty file still owns one (empty) block
+    if(num_blocks == 0){
+        num_blocks = 1;
+    }
+
+    // as few contiguous extents as possible, so the chain is read in long runs
+    if(alloc_blocks(num_blocks, blocks, goal)){
+        return -1;
+    }
+
+    // the last block is zero padded, all others are taken straight from data
+    std::vector<uint8_t> last_block(BLOCK_SIZE, 0);
+    size_t last_offset = (size_t)(num_blocks - 1) * BLOCK_SIZE;
+    std::memcpy(last_block.data(), data.data() + last_offset, data_size - last_offset);
+
+    // write each run of contiguous blocks with one vectored request
+    int failed = 0;
     {
-        if (!var.file_name[0])
-        {
-            isSpace = true;
+        data_scope unlocked(this, locked);
+        int run_start = 0;
+        for(int i = 1; i <= num_blocks && !failed; i++){
+            if(i < num_blocks && blocks[i] == blocks[i - 1] + 1){
+                continue;
+            }
+            std::vector<uint8_t*> blks;
+            for(int j = run_start; j < i; j++){
+                if(j == num_blocks - 1){
+                    blks.push_back(last_block.data());
+                } else {
+                    blks.push_back((uint8_t*)data.data() + (size_t)j * BLOCK_SIZE);
+                }
+            }
+            failed = cache.writev(blocks[run_start], blks.data(), blks.size());
+            run_start = i;
         }
-        if (std::string(var.file_name) == filename)
+    }
+    if(failed){
+        // nothing is linked yet, the blocks go back to the free map
+        release_blocks(blocks);
+        blocks.clear();
+        return -1;
+    }
+
+    return 0;
+}
+
+// links blocks, allocated with write_data_blocks, into a chain and returns
+// its first block
+int
+FS::link_blocks(const std::vector<int> &blocks){
+    for(size_t i = 0; i < blocks.size(); i++){
+        set_fat(blocks[i], i + 1 < blocks.size() ? blocks[i + 1] : FAT_EOF);
+    }
+    return blocks[0];
+}
+
+// hands allocated but never linked blocks back to the free map
+void
+FS::release_blocks(const std::vector<int> &blocks){
+    for(int b : blocks){
+        freemap.set_free(b);
+    }
+}
+
+// creates the file name with the content data in the directory parent. If
+// blocks is given, data has already been written to them.
+int
+FS::create_file(std::string data, uint32_t parent, std::string name, uint8_t permissions, const std::vector<int> *blocks){
+    struct dir_entry entry;
+
+    if (!valid_name(name) || !(dir_rights(parent) & WRITE) || dir_lookup(parent, name, entry) == 0)
+    {
+        if (blocks)
         {
-            return -1;
+            release_blocks(*blocks);
         }
+        return -1;
+    }
+
+    // tiny files are stored in the directory block, without a data block
+    if (data.size() <= INLINE_MAX)
+    {
+        std::memset(&entry, 0, sizeof(entry));
+        std::strncpy(entry.file_name, name.c_str(), sizeof(entry.file_name) - 1);
+        entry.size = data.size();
+        entry.type = TYPE_FILE;
+        entry.access_rights = permissions;
+        entry.inlined = 1;
+        return dir_add(parent, entry, data);
     }
 
-    if (!isSpace)
+    int first_block = blocks ? link_blocks(*blocks) : write_data_to_disk(data);
+    if (first_block == -1)
     {
         return -1;
     }
 
-    int first_block = write_data_to_disk(data);
+    return link_file(parent, name, first_block, data.size(), permissions);
+}
 
-    for(struct dir_entry &var : dir_entries){
-        if(!var.file_name[0]){
-            std::strncpy(var.file_name, filename.c_str(), sizeof(var.file_name) - 1);
-            var.file_name[sizeof(var.file_name) - 1] = '\0';
-            var.size = data.size();
-            var.first_blk = first_block;
-            var.type = 0;
-            var.access_rights = permissions;
-            break;
+// adds the file name, stored in the chain starting at first_block, to the
+// directory parent. The chain is freed if that fails.
+int
+FS::link_file(uint32_t parent, std::string name, int first_block, uint32_t size, uint8_t permissions){
+    struct dir_entry entry;
+
+    std::memset(&entry, 0, sizeof(entry));
+    std::strncpy(entry.file_name, name.c_str(), sizeof(entry.file_name) - 1);
+    entry.size = size;
+    entry.first_blk = first_block;
+    entry.type = TYPE_FILE;
+    entry.access_rights = permissions;
+
+    if (dir_add(parent, entry))
+    {
+        free_chain(first_block);
+        return -1;
+    }
+
+    return 0;
+}
+
+// copies the first size bytes of the chain starting at src_first to a new
+// chain and returns its first block. The whole destination is allocated up
+// front, then COPY_BLOCKS blocks at a time are read and written, each run of
+// contiguous blocks with one request.
+int
+FS::copy_chain(int src_first, uint32_t size){
+    unsigned num_blocks = std::max(1u, (unsigned)((size + BLOCK_SIZE - 1) / BLOCK_SIZE));
+    std::vector<int> dest;
+    if (alloc_blocks(num_blocks, dest)) {
+        return -1;
+    }
+
+    std::vector<int> src;
+    int block = src_first;
+    while (src.size() < num_blocks && block != FAT_EOF && block != FAT_FREE) {
+        src.push_back(block);
+        block = get_fat(block);
+    }
+
+    // the destination is not linked yet and the source directory is locked,
+    // so the data is copied with the other clients let in
+    int failed = 0;
+    {
+        data_scope unlocked(this);
+        std::vector<uint8_t> buffer((size_t)COPY_BLOCKS * BLOCK_SIZE);
+        std::vector<uint8_t*> blks;
+        for (unsigned done = 0; done < num_blocks && !failed; done += COPY_BLOCKS) {
+            unsigned end = std::min(done + COPY_BLOCKS, num_blocks);
+            unsigned src_end = std::min(end, (unsigned)src.size());
+
+            for (unsigned i = done, j; i < src_end; i = j) {
+                for (j = i + 1; j < src_end && src[j] == src[j - 1] + 1; j++)
+                    ;
+                failed |= cache.readv(src[i], j - i, buffer.data() + (size_t)(i - done) * BLOCK_SIZE);
+            }
+            // a chain shorter than its size reads as zeros
+            if (src_end < end) {
+                std::memset(buffer.data() + (size_t)(std::max(src_end, done) - done) * BLOCK_SIZE, 0,
+                        (size_t)(end - std::max(src_end, done)) * BLOCK_SIZE);
+            }
+
+            for (unsigned i = done, j; i < end; i = j) {
+                blks.clear();
+                for (j = i; j < end && (j == i || dest[j] == dest[j - 1] + 1); j++) {
+                    blks.push_back(buffer.data() + (size_t)(j - done) * BLOCK_SIZE);
+                }
+                failed |= cache.writev(dest[i], blks.data(), blks.size());
+            }
+        }
+    }
+    if (failed) {
+        // nothing is linked yet, hand the blocks back to the free map
+        for (int b : dest) {
+            freemap.set_free(b);
         }
-    }  
+        return -1;
+    }
 
-    if(pos != std::string::npos){
-        write_dir_to_disk(block_to_return);
-        read_dir_from_disk(current_working_block);
+    for (unsigned i = 0; i < num_blocks; i++) {
+        set_fat(dest[i], i + 1 < num_blocks ? dest[i + 1] : FAT_EOF);
     }
+    return dest[0];
+}
 
+// looks up the file filepath, which must be readable
+int
+FS::find_readable(std::string filepath, struct dir_entry &entry, struct dir_slot *slot) {
+    uint32_t parent;
+    std::string name;
+
+    if (resolve_parent(filepath, parent, name) || dir_lookup(parent, name, entry, slot)) {
+        return -1;
+    }
+    if (entry.type != TYPE_FILE || !(entry.access_rights & READ)) {
+        return -1;
+    }
     return 0;
 }
 
-std::string
-FS::read_file(std::string filepath) {
-    int i = -1;
-    std::string data;
-    std::vector<std::vector<uint8_t>> write_data;
+// reads the whole content of the file filepath into data
+int
+FS::read_file(std::string filepath, std::string &data) {
+    struct dir_entry entry;
+    struct dir_slot slot;
+
+    if (find_readable(filepath, entry, &slot)) {
+        return -1;
+    }
+    if (entry.inlined) {
+        return read_inline(slot, entry, data);
+    }
+    return read_chain(entry.first_blk, entry.size, data);
+}
+
+// writes the first size bytes of the chain starting at first_block to out.
+// Runs of contiguous blocks are read with one request each, at most
+// STREAM_BLOCKS at a time, so memory use does not depend on the file size.
+int
+FS::stream_chain(int first_block, uint32_t size, std::ostream &out) {
+    std::vector<uint8_t> buffer((size_t)STREAM_BLOCKS * BLOCK_SIZE);
+    uint32_t remaining = size;
+    int block = first_block;
+
+    while (remaining > 0 && block != FAT_EOF && block != FAT_FREE) {
+        unsigned wanted = (remaining + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        int run_start = block;
+        unsigned count = 0;
+        do {
+            count++;
+            block = get_fat(block);
+        } while (count < STREAM_BLOCKS && count < wanted && block == run_start + (int)count);
+
+        data_scope unlocked(this);
+        // a mapped disk is written out from the mapping
+        const uint8_t *data = cache.mapped(run_start, count);
+        if (!data) {
+            if (cache.readv(run_start, count, buffer.data())) {
+                return -1;
+            }
+            data = buffer.data();
+        }
+        size_t len = std::min((size_t)remaining, (size_t)count * BLOCK_SIZE);
+        out.write(reinterpret_cast<const char *>(data), len);
+        remaining -= len;
+    }
+
+    return out ? 0 : -1;
+}
+
+// returns the block map of the chain starting at first_block, walking the
+// chain only the first time
+struct block_map &
+FS::get_block_map(int first_block) {
+    auto it = block_maps.find(first_block);
+    if (it != block_maps.end()) {
+        return it->second;
+    }
+    if (block_maps.size() >= BLOCK_MAP_CACHE) {
+        block_maps.clear();
+    }
+    struct block_map &map = block_maps[first_block];
+    int block = first_block;
+    while (block != FAT_EOF && block != FAT_FREE) {
+        map_append(map, block);
+        block = get_fat(block);
+    }
+    return map;
+}
+
+// forgets the block map of a chain, needed whenever the chain changes
+void
+FS::drop_block_map(int first_block) {
+    block_maps.erase(first_block);
+}
+
+// returns the block at index in the file, -1 past the end
+int
+FS::map_block(const struct block_map &map, unsigned index) {
+    if (index >= map.count) {
+        return -1;
+    }
+    size_t i = std::upper_bound(map.starts.begin(), map.starts.end(), index) - map.starts.begin() - 1;
+    return map.extents[i].start + (index - map.starts[i]);
+}
+
+// returns the blocks at index first to last in the file
+void
+FS::map_range(const struct block_map &map, unsigned first, unsigned last, std::vector<int> &blocks) {
+    if (first > last || first >= map.count) {
+        return;
+    }
+    last = std::min(last, map.count - 1);
+    size_t i = std::upper_bound(map.starts.begin(), map.starts.end(), first) - map.starts.begin() - 1;
+    for (unsigned index = first; index <= last; i++) {
+        for (; index <= last && index < map.starts[i] + map.extents[i].count; index++) {
+            blocks.push_back(map.extents[i].start + (index - map.starts[i]));
+        }
+    }
+}
+
+// adds a block to the end of the file
+void
+FS::map_append(struct block_map &map, int block) {
+    if (!map.extents.empty() && (unsigned)block == map.extents.back().start + map.extents.back().count) {
+        map.extents.back().count++;
+    } else {
+        map.starts.push_back(map.count);
+        map.extents.push_back(extent{ (unsigned)block, 1 });
+    }
+    map.count++;
+}
+
+// decides what to read ahead when the blocks first to last of a sequence
+// (a file, the FAT) are about to be read. A read that continues the previous
+// one doubles the window, any other read resets it. Returns true and the
+// indexes [from, to) when more should be read ahead, which is when less
+// than half a window is left.
+bool
+FS::readahead(struct readahead_state &ra, unsigned first, unsigned last, unsigned limit, unsigned &from, unsigned &to) {
+    unsigned max_window = cache.get_readahead_window();
+    if (first == ra.next && ra.next > 0) {
+        ra.window = ra.window ? std::min(2 * ra.window, max_window) : std::min(4u, max_window);
+    } else {
+        ra.window = 0;
+        ra.ahead = 0;
+    }
+    ra.next = last + 1;
+    if (ra.window == 0 || ra.ahead > last + 1 + ra.window / 2) {
+        return false;
+    }
+    from = std::max(ra.ahead, last + 1);
+    to = std::min(last + 1 + ra.window, limit);
+    if (from >= to) {
+        return false;
+    }
+    ra.ahead = to;
+    return true;
+}
+
+// reads up to len bytes at offset of the file entry into buf, returns the
+// number of bytes read. Only the blocks holding the range are read.
+int
+FS::read_range(const struct dir_entry &entry, struct dir_slot slot, uint32_t offset, uint32_t len, uint8_t *buf) {
+    if (offset >= entry.size || len == 0) {
+        return 0;
+    }
+    len = std::min(len, entry.size - offset);
+
+    if (entry.inlined) {
+        std::string data;
+        if (read_inline(slot, entry, data)) {
+            return -1;
+        }
+        std::memcpy(buf, data.data() + offset, len);
+        return len;
+    }
+
+    struct block_map &map = get_block_map(entry.first_blk);
+    unsigned first = offset / BLOCK_SIZE;
+    unsigned last = (offset + (uint64_t)len - 1) / BLOCK_SIZE;
+    if (first >= map.count) {
+        return 0;
+    }
+    last = std::min(last, map.count - 1);
+
+    // small sequential reads, e.g. through a handle, find the next blocks
+    // in the cache
+    unsigned from, to;
+    if (readahead(map.ra, first, last, map.count, from, to)) {
+        std::vector<int> ahead;
+        map_range(map, from, to - 1, ahead);
+        for (size_t i = 0, j; i < ahead.size(); i = j) {
+            for (j = i + 1; j < ahead.size() && ahead[j] == ahead[j - 1] + 1; j++)
+                ;
+            cache.prefetch(ahead[i], j - i);
+        }
+    }
+
+    // the runs to read, so the block map is not needed once the other
+    // readers are let in
+    std::vector<struct extent> runs;
+    size_t e = std::upper_bound(map.starts.begin(), map.starts.end(), first) - map.starts.begin() - 1;
+    for (unsigned i = first; i <= last; e++) {
+        unsigned extent_end = std::min(map.starts[e] + map.extents[e].count, last + 1);
+        for (unsigned j; i < extent_end; i = j) {
+            j = std::min(extent_end, i + STREAM_BLOCKS);
+            runs.push_back(extent{ map.extents[e].start + (i - map.starts[e]), j - i });
+        }
+    }
+
+    // each run is read with one request into a bounce buffer and copied
+    // from there, or copied straight from a mapped disk
+    data_scope unlocked(this);
+    std::vector<uint8_t> buffer((size_t)STREAM_BLOCKS * BLOCK_SIZE);
+    uint32_t done = 0;
+    uint64_t run_start = (uint64_t)first * BLOCK_SIZE;
+    for (const struct extent &run : runs) {
+        const uint8_t *data = cache.mapped(run.start, run.count);
+        if (!data) {
+            if (cache.readv(run.start, run.count, buffer.data())) {
+                return -1;
+            }
+            data = buffer.data();
+        }
+        uint64_t from = std::max((uint64_t)offset, run_start);
+        uint64_t to = std::min((uint64_t)offset + len, run_start + (uint64_t)run.count * BLOCK_SIZE);
+        std::memcpy(buf + (from - offset), data + (from - run_start), to - from);
+        done += to - from;
+        run_start += (uint64_t)run.count * BLOCK_SIZE;
+    }
+    return done;
+}
+
+// writes len bytes from buf at offset of the file entry, stored at slot in
+// the directory parent. The file grows when the range ends past its size, a
+// gap between the old size and offset reads as zeros. Only the blocks in the
+// range are written, partly covered ones are read first.
+int
+FS::write_range(uint32_t parent, struct dir_slot slot, struct dir_entry &entry, uint32_t offset, const uint8_t *buf, uint32_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    uint64_t end = (uint64_t)offset + len;
+    if (end > UINT32_MAX) {
+        return -1;
+    }
+    if (promote_inline(parent, slot, entry)) {
+        return -1;
+    }
+    uint32_t size = entry.size;
+    uint32_t new_size = std::max((uint64_t)size, end);
+    uint32_t start = std::min(offset, size);
+    unsigned old_last = size == 0 ? 0 : (size - 1) / BLOCK_SIZE;
+    unsigned new_last = (new_size - 1) / BLOCK_SIZE;
+
+    // every block that changes, and the last one if the chain grows, must
+    // not be shared. A copied first block is recorded right away, so the
+    // copies stay linked if the write fails below.
+    uint32_t first_blk = entry.first_blk;
+    if (unshare_chain(entry, new_last > old_last ? old_last : (end - 1) / BLOCK_SIZE)) {
+        return -1;
+    }
+    if (entry.first_blk != first_blk) {
+        dir_update(parent, slot, entry);
+    }
+    // blocks[k] is the block at index base + k of the file. The old last
+    // block is always included, an append at a block boundary starts past it.
+    struct block_map &map = get_block_map(entry.first_blk);
+    if (map.count != old_last + 1) {
+        return -1;
+    }
+    unsigned first = start / BLOCK_SIZE;
+    unsigned base = std::min(first, old_last);
+    std::vector<int> blocks;
+    map_range(map, base, old_last, blocks);
+    std::vector<int> new_blocks;
+    if (new_last > old_last) {
+        if (alloc_blocks(new_last - old_last, new_blocks, blocks.back() + 1)) {
+            return -1;
+        }
+        blocks.insert(blocks.end(), new_blocks.begin(), new_blocks.end());
+    }
 
-    for (const struct dir_entry& var : dir_entries) {
-        if (std::string(var.file_name) == filepath) {
-            i = var.first_blk;
-            if(!check_permissions(0x04, i, 0)){
-                return "";
+    int failed = 0;
+    {
+        // the directory of the file is locked, so only the data is written with
+        // the other clients let in
+        data_scope unlocked(this);
+        std::vector<uint8_t> buffer((size_t)STREAM_BLOCKS * BLOCK_SIZE);
+        std::vector<uint8_t*> blks;
+        for (unsigned i = first, j; i <= new_last && !failed; i = j) {
+            blks.clear();
+            for (j = i; j <= new_last && j - i < STREAM_BLOCKS && (j == i || blocks[j - base] == blocks[j - base - 1] + 1); j++) {
+                uint8_t *block = buffer.data() + (size_t)(j - i) * BLOCK_SIZE;
+                uint64_t block_start = (uint64_t)j * BLOCK_SIZE;
+                uint64_t block_end = block_start + BLOCK_SIZE;
+                if (offset <= block_start && end >= block_end) {
+                    std::memcpy(block, buf + (block_start - offset), BLOCK_SIZE);
+                } else {
+                    if (j <= old_last) {
+                        failed = cache.readv(blocks[j - base], 1, block);
+                        if (failed) {
+                            break;
+                        }
+                    } else {
+                        std::memset(block, 0, BLOCK_SIZE);
+                    }
+                    // the gap between the old end of the file and offset
+                    uint64_t gap_from = std::max((uint64_t)size, block_start);
+                    uint64_t gap_to = std::min((uint64_t)offset, block_end);
+                    if (gap_from < gap_to) {
+                        std::memset(block + (gap_from - block_start), 0, gap_to - gap_from);
+                    }
+                    uint64_t from = std::max((uint64_t)offset, block_start);
+                    uint64_t to = std::min(end, block_end);
+                    if (from < to) {
+                        std::memcpy(block + (from - block_start), buf + (from - offset), to - from);
+                    }
+                }
+                blks.push_back(block);
+            }
+            if (!failed) {
+                failed = cache.writev(blocks[i - base], blks.data(), blks.size());
             }
-            break;
         }
     }
+    if (failed) {
+        // the new blocks are not linked yet, the file keeps its old size
+        release_blocks(new_blocks);
+        return -1;
+    }
 
-    if (i != -1) {
-        do {
-            std::vector<uint8_t> block(BLOCK_SIZE, 0);
-
-            disk.read(i, block.data());
-
-            block[BLOCK_SIZE - 1] = '\0';
+    for (unsigned i = old_last; i < new_last; i++) {
+        set_fat(blocks[i - base], blocks[i - base + 1]);
+    }
+    if (new_last > old_last) {
+        set_fat(blocks[new_last - base], FAT_EOF);
+        // the map may have been dropped and read again meanwhile, from the
+        // FAT as it is now
+        struct block_map &grown = get_block_map(entry.first_blk);
+        if (grown.count == old_last + 1) {
+            for (int block : new_blocks) {
+                map_append(grown, block);
+            }
+        }
+    }
 
-            write_data.push_back(block);
+    entry.size = new_size;
+    dir_update(parent, slot, entry);
+    return len;
+}
 
-            i = fat[i];
-        } while (i != FAT_EOF);
+// reads the first size bytes of the chain starting at first_block into data
+int
+FS::read_chain(int first_block, uint32_t size, std::string &data) {
+    std::vector<int> blocks;
+    int i = first_block;
+    while (i != FAT_EOF && i != FAT_FREE) {
+        blocks.push_back(i);
+        i = get_fat(i);
     }
 
-    int actual_file_size = 0;
-    for (const struct dir_entry& var : dir_entries) {
-        if (std::string(var.file_name) == filepath) {
-            actual_file_size = var.size;
-            break;
+    // read each run of contiguous blocks with one vectored request
+    std::vector<uint8_t> buffer((size_t)blocks.size() * BLOCK_SIZE, 0);
+    size_t run_start = 0;
+    for (size_t j = 1; j <= blocks.size(); j++) {
+        if (j < blocks.size() && blocks[j] == blocks[j - 1] + 1) {
+            continue;
         }
+        cache.readv(blocks[run_start], j - run_start, buffer.data() + run_start * BLOCK_SIZE);
+        run_start = j;
     }
 
-    size_t bytes_to_read = actual_file_size;
-    for (const auto block : write_data) {
-        size_t bytes_in_block = std::min(bytes_to_read, (size_t)BLOCK_SIZE);
-        data.append(block.begin(), block.begin() + bytes_in_block);
-    }
+    size_t actual_file_size = std::min((size_t)size, buffer.size());
+    data.assign(buffer.begin(), buffer.begin() + actual_file_size);
 
-    return data;
+    return 0;
 }
 
 // formats the disk, i.e., creates an empty file system
-int FS::format()
+int FS::format(unsigned no_blocks)
 {
-    for (int16_t &var : fat)
-    {
-        var = 0x0000;
+    op_scope scope(this);
+    if (no_blocks == 0) {
+        no_blocks = disk.get_no_blocks();
+    }
+    unsigned fat_blocks = (no_blocks + FAT_ENTRIES_PER_BLOCK - 1) / FAT_ENTRIES_PER_BLOCK;
+    unsigned journal_blocks = std::min<unsigned>(JOURNAL_BLOCKS, no_blocks / 8);
+    if (journal_blocks < JOURNAL_MIN_BLOCKS) {
+        journal_blocks = 0;
+    }
+    // superblock, FAT, journal, root directory and at least one data block
+    if (no_blocks < FAT_START + fat_blocks + journal_blocks + 2 || no_blocks >= (1u << 27)) {
+        return -1;
+    }
+    // whatever is cached belongs to the old file system
+    mounted = false;
+    cache.set_journal(nullptr);
+    journal.close();
+    cache.discard();
+    if (disk.resize(no_blocks)) {
+        return -1;
     }
-    fat[0] = 0xFFFF;
-    fat[1] = 0xFFFF;
 
-    disk.write(1, reinterpret_cast<uint8_t *>(fat));
+    sb.magic = FS_MAGIC;
+    sb.version = FS_VERSION;
+    sb.block_size = BLOCK_SIZE;
+    sb.no_blocks = no_blocks;
+    sb.fat_start = FAT_START;
+    sb.fat_blocks = fat_blocks;
+    sb.journal_start = FAT_START + fat_blocks;
+    sb.journal_blocks = journal_blocks;
+    sb.root_block = sb.journal_start + journal_blocks;
+    sb.refcount_block = 0;
+    sb.clean = 0;
+    sb.free_blocks = no_blocks - sb.root_block - 1;
+    shared_refs.clear();
+    refs_dirty = false;
+    if (journal_blocks && journal.create(sb.journal_start, journal_blocks)) {
+        sb.journal_blocks = 0;
+    }
+    write_superblock();
+
+    // entries past the end of the disk stay in use so they are never allocated
+    fat.assign((size_t)fat_blocks * FAT_ENTRIES_PER_BLOCK, FAT_EOF);
+    fat_loaded.assign(fat_blocks, true);
+    fat_dirty.assign(fat_blocks, true);
+    freemap.reset(no_blocks);
+    freed.clear();
+    for (unsigned i = sb.root_block + 1; i < no_blocks; i++) {
+        fat[i] = FAT_FREE;
+        freemap.set_free(i);
+    }
 
-    for (struct dir_entry &var : dir_entries)
-    {
-        std::memset(var.file_name, 0, sizeof(var.file_name));
-        var.size = 0;
-        var.first_blk = 0;
-        var.type = 0;
-        var.access_rights = 0;
+    // empty root directory
+    uint8_t block[BLOCK_SIZE] = {0};
+    cache.write(sb.root_block, block);
+
+    // the new file system goes to its home blocks before the journal is
+    // used, mount checks the superblock before it replays the journal
+    write_fat_to_disk();
+    if (cache.sync() || disk.sync()) {
+        return -1;
+    }
+    if (sb.journal_blocks) {
+        cache.set_journal(&journal);
     }
+    dir_indexes.clear();
+    dentries.clear();
+    block_maps.clear();
+    handles.clear();
+    dir_locks.clear();
+    reset_clients();
+    mounted = true;
     return 0;
 }
 
@@ -346,35 +1808,87 @@ FS::create(std::string filepath)
         data.append(input + "\n");
     }
 
-    return create_file(data, filepath);
+    return create(filepath, data);
 }
 
-// cat <filepath> reads the content of a file and prints it on the screen
-int FS::cat(std::string filepath) {   
-    std::string read_data = read_file(filepath);
+int
+FS::create(std::string filepath, const std::string &data)
+{
+    std::vector<int> blocks;
+    unsigned gen = 0;
+    if (data.size() > INLINE_MAX)
+    {
+        // nobody can reach these blocks yet, so their data is written while
+        // other clients keep reading and creating
+        op_scope scope(this, OP_SHARED);
+        gen = generation;
+        if (!mounted || write_data_blocks(data, blocks))
+        {
+            return -1;
+        }
+    }
 
-    if(read_data == ""){
+    op_scope scope(this, OP_CHANGE);
+    // formatted or mounted in between, the blocks belong to the old file system
+    if (!blocks.empty() && gen != generation)
+    {
         return -1;
     }
+    uint32_t parent;
+    std::string name;
+    do
+    {
+        if (resolve_parent(filepath, parent, name))
+        {
+            release_blocks(blocks);
+            return -1;
+        }
+    } while (!lock_dirs({ parent }));
+
+    return create_file(data, parent, name, READ | WRITE, blocks.empty() ? nullptr : &blocks);
+}
+
+// cat <filepath> reads the content of a file and prints it on the screen
+int FS::cat(std::string filepath, std::ostream &out) {   
+    op_scope scope(this, OP_SHARED);
+    struct dir_entry entry;
+    struct dir_slot slot;
 
-    if (read_data.empty()) {
+    if (find_readable(filepath, entry, &slot)) {
         return -1;
     }
 
-    std::cout << read_data << std::endl;
+    if (entry.inlined) {
+        std::string data;
+        if (read_inline(slot, entry, data)) {
+            return -1;
+        }
+        out << data;
+    } else if (stream_chain(entry.first_blk, entry.size, out)) {
+        return -1;
+    }
+    out << '\n';
+    out.flush();
 
     return 0;
 }
 
 // ls lists the content in the currect directory (files and sub-directories)
 int 
-FS::ls()
+FS::ls(std::ostream &out)
 {
-    std::cout << std::left << std::setw(9) << "name" << std::setw(8) << "type" << std::setw(8) << "accessrights" << "   "<< std::setw(8) << "size" << std::endl;
-    for (struct dir_entry var : dir_entries)
+    op_scope scope(this, OP_SHARED);
+    std::vector<struct dir_entry> entries;
+    if (!mounted) {
+        return -1;
+    }
+    dir_list(self().cwd, entries);
+
+    out << std::left << std::setw(9) << "name" << std::setw(8) << "type" << std::setw(8) << "accessrights" << "   "<< std::setw(8) << "size" << std::endl;
+    for (struct dir_entry var : entries)
     {
         std::string permissions = "---";
-        if (var.file_name[0] && std::string(var.file_name) != "..")
+        if (std::string(var.file_name) != "..")
         {   
             if(var.access_rights & 0x01){
                 permissions[2] = 'x';
@@ -386,9 +1900,9 @@ FS::ls()
                 permissions[0] = 'r';
             }
             if(var.type == 0){
-                std::cout << std::left << std::setw(7) << var.file_name << "   " << std::setw(6) << "file" << "   " << std::setw(6) << permissions << std::setw(6) << "   " << var.size << std::endl;
+                out << std::left << std::setw(7) << var.file_name << "   " << std::setw(6) << "file" << "   " << std::setw(6) << permissions << std::setw(6) << "   " << var.size << std::endl;
             } else {
-                std::cout << std::left << std::setw(7) << var.file_name << "   " << std::setw(6) << "dir" << "   " << std::setw(6) << permissions << std::setw(6) << "   " << "-" << std::endl;
+                out << std::left << std::setw(7) << var.file_name << "   " << std::setw(6) << "dir" << "   " << std::setw(6) << permissions << std::setw(6) << "   " << "-" << std::endl;
             }
             
         }
@@ -399,101 +1913,122 @@ FS::ls()
 
 // cp <sourcepath> <destpath> makes an exact copy of the file
 // <sourcepath> to a new file <destpath>
-int FS::cp(std::string sourcepath, std::string destpath)
+int FS::cp(std::string sourcepath, std::string destpath, bool reflink)
 {
-    std::string read_data = read_file(sourcepath);
-    int block_to_enter = check_name_exists(destpath);
-
-    if (read_data.empty()) {
+    op_scope scope(this, OP_CHANGE);
+    struct dir_entry entry;
+    struct dir_slot slot;
+    uint32_t src_parent, parent;
+    std::string src_name, name;
+
+    // the source directory too, the source is read with it unlocked
+    do {
+        if (resolve_parent(sourcepath, src_parent, src_name)
+                || resolve_target(sourcepath, destpath, parent, name)) {
+            return -1;
+        }
+    } while (!lock_dirs({ src_parent, parent }));
+    if (find_readable(sourcepath, entry, &slot) || !(dir_rights(parent) & WRITE)) {
         return -1;
     }
 
-    if(block_to_enter == -1){
-        return -1;
-    } else if(block_to_enter != 1){
-        destpath.append("/" + sourcepath);
+    // an inlined file has no blocks to share, it is copied as it is
+    if (entry.inlined) {
+        std::string data;
+        if (read_inline(slot, entry, data)) {
+            return -1;
+        }
+        return create_file(data, parent, name, READ | WRITE);
     }
 
-    create_file(read_data, destpath, sourcepath);
+    if (reflink) {
+        // the new entry is one more reference to the first block
+        add_ref(entry.first_blk);
+        return link_file(parent, name, entry.first_blk, entry.size, READ | WRITE);
+    }
 
-    return 0;
+    // block to block, the data never passes through a std::string
+    int first_block = copy_chain(entry.first_blk, entry.size);
+    if (first_block == -1) {
+        return -1;
+    }
+
+    return link_file(parent, name, first_block, entry.size, READ | WRITE);
 }
 
 // mv <sourcepath> <destpath> renames the file <sourcepath> to the name <destpath>,
 // or moves the file <sourcepath> to the directory <destpath> (if dest is a directory)
 int FS::mv(std::string sourcepath, std::string destpath)
 {
-    struct dir_entry old_entry;
-    int i = 0;
-    int block_to_enter;
-    std::string filename = destpath;
-    int block_to_return = current_working_block;
-
-    for (struct dir_entry &var : dir_entries) {
-        if (std::string(var.file_name) == sourcepath) {
-            old_entry = var;
+    op_scope scope(this, OP_CHANGE);
+    uint32_t src_parent, dst_parent;
+    std::string src_name, dst_name;
+    struct dir_entry entry;
+    struct dir_slot src_slot;
+
+    // a directory that moves gets a new "..", so it is locked as well
+    do {
+        if (resolve_parent(sourcepath, src_parent, src_name) || src_name == "." || src_name == ".."
+                || dir_lookup(src_parent, src_name, entry, &src_slot)) {
+            return -1;
+        }
+        if (resolve_target(sourcepath, destpath, dst_parent, dst_name)) {
+            return -1;
         }
-        i++;
+    } while (!lock_dirs({ src_parent, dst_parent, entry.type == TYPE_DIR ? (uint32_t)entry.first_blk : src_parent }));
+    if (!(dir_rights(src_parent) & WRITE) || !(dir_rights(dst_parent) & WRITE)) {
+        return -1;
     }
-    write_dir_to_disk(current_working_block);
 
-    if(destpath != "/"){
-        std::size_t pos = destpath.find_last_of("/");
-        if(pos != std::string::npos){
-            filename = destpath.substr(pos + 1);
-            destpath.erase(pos);
-            if(destpath == ""){
-                destpath = "/";
+    if (entry.type == TYPE_DIR && dst_parent != src_parent) {
+        // a directory can not be moved into itself or one of its sub-directories
+        uint32_t dir = dst_parent;
+        while (dir != sb.root_block) {
+            if (dir == entry.first_blk) {
+                return -1;
+            }
+            struct dir_entry parent;
+            if (dir_lookup(dir, "..", parent)) {
+                return -1;
             }
-            block_to_return = move_to_path(destpath);
+            dir = parent.first_blk;
         }
-        block_to_enter = check_name_exists(filename);
-    } else {
-        block_to_enter = 0;
     }
 
-    if(block_to_enter == -1) {
-        read_dir_from_disk(current_working_block);
+    struct dir_entry new_entry = entry;
+    std::memset(new_entry.file_name, 0, sizeof(new_entry.file_name));
+    std::strncpy(new_entry.file_name, dst_name.c_str(), sizeof(new_entry.file_name) - 1);
+    // the data of an inlined file moves along with the entry
+    std::string data;
+    if (entry.inlined && read_inline(src_slot, entry, data)) {
+        return -1;
+    }
+    // remove first, a rename within one directory may reuse the same slot
+    dir_remove(src_parent, src_name);
+    if (dir_add(dst_parent, new_entry, data)) {
+        dir_add(src_parent, entry, data);
         return -1;
-    } else if(block_to_enter != 1) {
-        read_dir_from_disk(block_to_enter);
-        if(check_name_exists(sourcepath) == 1){
-            for(struct dir_entry &var : dir_entries){
-                if(!var.file_name[0]){
-                    var = old_entry;
-                    break;
-                }
-            }
-            write_dir_to_disk(block_to_enter);
-        } else {
-            read_dir_from_disk(current_working_block);
-            return -1;
-        }
-    } else if(block_to_enter == 1) {
-        for(struct dir_entry &var : dir_entries){
-            if(!var.file_name[0]){
-                var = old_entry;
-                std::strncpy(var.file_name, filename.c_str(), sizeof(var.file_name) - 1);
-                var.file_name[sizeof(var.file_name) - 1] = '\0';
-                break;
-            }
-        }
-        write_dir_to_disk(block_to_return);
     }
 
-    read_dir_from_disk(current_working_block);
+    // open handles follow the entry to its new slot
+    struct dir_slot dst_slot;
+    dir_lookup(dst_parent, dst_name, new_entry, &dst_slot);
+    for (struct open_file &h : handles) {
+        if (h.used && h.slot.block == src_slot.block && h.slot.index == src_slot.index) {
+            h.parent = dst_parent;
+            h.slot = dst_slot;
+            h.entry = new_entry;
+        }
+    }
 
-    for (struct dir_entry &var : dir_entries) {
-        if (std::string(var.file_name) == sourcepath) {
-            std::memset(var.file_name, 0, sizeof(var.file_name));
-            var.size = 0;
-            var.first_blk = 0;
-            var.type = 0;
-            var.access_rights = 0;
+    if (entry.type == TYPE_DIR && dst_parent != src_parent) {
+        struct dir_slot slot;
+        struct dir_entry parent;
+        if (dir_lookup(entry.first_blk, "..", parent, &slot) == 0) {
+            parent.first_blk = dst_parent;
+            dir_update(entry.first_blk, slot, parent);
         }
     }
-    write_dir_to_disk(current_working_block);
-    
 
     return 0;
 }
@@ -501,39 +2036,30 @@ int FS::mv(std::string sourcepath, std::string destpath)
 // rm <filepath> removes / deletes the file <filepath>
 int FS::rm(std::string filepath)
 {
-    if(check_name_exists(filepath) == 1){
+    op_scope scope(this, OP_CHANGE);
+    uint32_t parent;
+    std::string name;
+    struct dir_entry entry;
+    struct dir_slot slot;
+
+    do {
+        if (resolve_parent(filepath, parent, name)) {
+            return -1;
+        }
+    } while (!lock_dirs({ parent }));
+    if (dir_lookup(parent, name, entry, &slot)) {
         return -1;
     }
-
-    int current_block = 0;
-    int next_block = 0;
-    
-    for(struct dir_entry &var : dir_entries){
-        if(std::string(var.file_name) == filepath){
-            current_block = var.first_blk;
-            std::memset(var.file_name, 0, sizeof(var.file_name));
-            var.size = 0;
-            var.first_blk = 0;
-            var.type = 0;
-            var.access_rights = 0;
-            break;
-        }
+    // open files can not be removed
+    if (entry.type != TYPE_FILE || !(dir_rights(parent) & WRITE) || is_open(slot)) {
+        return -1;
     }
 
-    if(fat[current_block] == FAT_EOF){
-        fat[current_block] = 0x0000;
-    } else {
-        do{
-            next_block = fat[current_block];
-            fat[current_block] = 0x0000;
-            current_block = next_block;
-        } while(next_block != FAT_EOF);
-
-        fat[next_block] = 0x0000;
+    dir_remove(parent, name);
+    if (!entry.inlined) {
+        free_chain(entry.first_blk);
     }
 
-    write_fat_to_disk();
-
     return 0;
 }
 
@@ -541,31 +2067,72 @@ int FS::rm(std::string filepath)
 // the end of file <filepath2>. The file <filepath1> is unchanged.
 int FS::append(std::string filepath1, std::string filepath2)
 {
-    std::string file1 = read_file(filepath1);
-
-    if(file1 == ""){
+    op_scope scope(this, OP_CHANGE);
+    std::string file1;
+    uint32_t parent;
+    std::string name;
+    struct dir_entry entry;
+    struct dir_slot slot;
+
+    do {
+        if (resolve_parent(filepath2, parent, name)) {
+            return -1;
+        }
+    } while (!lock_dirs({ parent }));
+    if (read_file(filepath1, file1) || dir_lookup(parent, name, entry, &slot)) {
+        return -1;
+    }
+    if (entry.type != TYPE_FILE || !(entry.access_rights & WRITE)) {
         return -1;
     }
+    if (file1.empty()) {
+        return 0;
+    }
 
-    for(struct dir_entry &var : dir_entries){
-        if(std::string(var.file_name) == filepath2){
-            if(!check_permissions(2, var.first_blk, 0)){
-                return -1;
-            }
-            var.size += file1.size();
-            int current_block = var.first_blk;
+    if (promote_inline(parent, slot, entry)) {
+        return -1;
+    }
 
-            while(fat[current_block] != FAT_EOF){
-                current_block = fat[current_block];
-            }
+    // the last block is filled up and gets a new FAT link, so it must not
+    // be shared
+    uint32_t size = entry.size;
+    unsigned last_index = size == 0 ? 0 : (size - 1) / BLOCK_SIZE;
+    if (unshare_chain(entry, last_index)) {
+        return -1;
+    }
+    dir_update(parent, slot, entry);
+    int current_block = map_block(get_block_map(entry.first_blk), last_index);
+    if (current_block == -1) {
+        return -1;
+    }
 
-            fat[current_block] = write_data_to_disk(file1);
-            break;
+    // only what does not fit in the unused tail of the last block goes to
+    // new blocks, right after the last one. They are written first, so a
+    // full disk leaves the file unchanged.
+    size_t used = size - (size_t)last_index * BLOCK_SIZE;
+    size_t fill = std::min(BLOCK_SIZE - used, file1.size());
+    int first_block = FAT_EOF;
+    if (fill < file1.size()) {
+        first_block = write_data_to_disk(file1.substr(fill), current_block + 1);
+        if (first_block == -1) {
+            return -1;
         }
     }
 
-    write_dir_to_disk(current_working_block);
-    write_fat_to_disk();
+    if (fill > 0) {
+        uint8_t block[BLOCK_SIZE];
+        uint8_t *blk = block;
+        cache.readv(current_block, 1, block);
+        std::memcpy(block + used, file1.data(), fill);
+        cache.writev(current_block, &blk, 1);
+    }
+    if (first_block != FAT_EOF) {
+        set_fat(current_block, first_block);
+        drop_block_map(entry.first_blk);
+    }
+
+    entry.size += file1.size();
+    dir_update(parent, slot, entry);
 
     return 0;
 }
@@ -574,77 +2141,50 @@ int FS::append(std::string filepath1, std::string filepath2)
 // in the current directory
 int FS::mkdir(std::string dirpath)
 {
-    int block_to_enter;
-    int block_to_return = current_working_block;
-    int first_block = find_empty_block();
-    std::string dirname = dirpath;
-
-    if(dirpath != "/"){
-        std::size_t pos = dirpath.find_last_of("/");
-        if(pos != std::string::npos){
-            dirname = dirpath.substr(pos + 1);
-            dirpath.erase(pos);
-            if(dirpath == ""){
-                dirpath = "/";
-            }
-            block_to_return = move_to_path(dirpath);
-            if(block_to_return == -1){
-                return -1;
-            }
+    op_scope scope(this, OP_CHANGE);
+    uint32_t parent;
+    std::string dirname;
+    struct dir_entry entry;
+
+    do {
+        if (resolve_parent(dirpath, parent, dirname)) {
+            return -1;
         }
-        block_to_enter = check_name_exists(dirname);
-    } else {
+    } while (!lock_dirs({ parent }));
+    if (!valid_name(dirname)) {
         return -1;
     }
-
-    if(!check_permissions(2, block_to_return, 1)){
+    if (!(dir_rights(parent) & WRITE) || dir_lookup(parent, dirname, entry) == 0) {
         return -1;
-    };
+    }
 
-    if(block_to_enter == -1) {
+    int first_block = find_empty_block();
+    if (first_block == -1) {
         return -1;
-    };
-
-    for(struct dir_entry &var : dir_entries){
-        if(!var.file_name[0]){
-            std::strncpy(var.file_name, dirname.c_str(), sizeof(var.file_name) - 1);
-            var.file_name[sizeof(var.file_name) - 1] = '\0';
-            var.size = 0;
-            var.first_blk = first_block;
-            var.type = 1;
-            var.access_rights =  0x07;
-            break;
-        }
-    }  
-
-    uint8_t block[BLOCK_SIZE] = {0};
-
-    struct dir_entry sub_dir_entries[BLOCK_SIZE / sizeof(struct dir_entry)];
-
-    for (struct dir_entry &var : sub_dir_entries)
-    {
-        std::memset(var.file_name, 0, sizeof(var.file_name));
-        var.size = 0;
-        var.first_blk = 0;
-        var.type = 0;
-        var.access_rights = 0;
     }
 
+    // the new directory starts with a single block holding only ".."
+    uint8_t block[BLOCK_SIZE] = {0};
+    struct dir_entry *sub_dir_entries = reinterpret_cast<struct dir_entry *>(block);
     std::strncpy(sub_dir_entries[0].file_name, "..", sizeof(sub_dir_entries[0].file_name) - 1);
-    sub_dir_entries[0].file_name[sizeof(sub_dir_entries[0].file_name) - 1] = '\0';
-    sub_dir_entries[0].size = 0;
-    sub_dir_entries[0].first_blk = block_to_return;
-    sub_dir_entries[0].type = 1;
-    sub_dir_entries[0].access_rights = 0x07;
-
-    std::memcpy(block, sub_dir_entries, sizeof(sub_dir_entries));
-
-    disk.write(first_block, block);
-    write_dir_to_disk(block_to_return);
-    read_dir_from_disk(current_working_block);
-
-    fat[first_block] = FAT_EOF;
-    write_fat_to_disk();
+    sub_dir_entries[0].first_blk = parent;
+    sub_dir_entries[0].type = TYPE_DIR;
+    sub_dir_entries[0].access_rights = READ | WRITE | EXECUTE;
+    // not reachable before the entry is added, so it is written like file
+    // data instead of going through the journal
+    uint8_t *blk = block;
+    cache.writev(first_block, &blk, 1);
+    set_fat(first_block, FAT_EOF);
+
+    std::memset(&entry, 0, sizeof(entry));
+    std::strncpy(entry.file_name, dirname.c_str(), sizeof(entry.file_name) - 1);
+    entry.first_blk = first_block;
+    entry.type = TYPE_DIR;
+    entry.access_rights = READ | WRITE | EXECUTE;
+    if (dir_add(parent, entry)) {
+        set_fat(first_block, FAT_FREE);
+        return -1;
+    }
 
     return 0;
 }
@@ -652,45 +2192,48 @@ int FS::mkdir(std::string dirpath)
 // cd <dirpath> changes the current (working) directory to the directory named <dirpath>
 int FS::cd(std::string dirpath)
 {
-    int block_to_return = move_to_path(dirpath);
-    if(block_to_return != -1){
-        current_working_block = block_to_return;
-    } else {
+    op_scope scope(this, OP_SHARED);
+    uint32_t dir;
+    if (resolve_dir(dirpath, dir)) {
         return -1;
     }
+    self().cwd = dir;
 
     return 0;
 }
 
 // pwd prints the full path, i.e., from the root directory, to the current
 // directory, including the currect directory name
-int FS::pwd()
+int FS::pwd(std::ostream &out)
 {
-    int temp_parent;
-    int temp_child = current_working_block;
+    op_scope scope(this, OP_SHARED);
+    if (!mounted) {
+        return -1;
+    }
+    uint32_t dir = self().cwd;
     std::string path = "";
-    write_dir_to_disk(current_working_block);
-    if(temp_child != 0){
-        do {
-            temp_parent = dir_entries[0].first_blk;
-            read_dir_from_disk(temp_parent);
-            for(struct dir_entry var : dir_entries){
-                if(var.first_blk == temp_child){
-                    std::string temp_path = "/" + std::string(var.file_name);
-                    temp_path += path;
-                    path = temp_path;
-                    temp_child = temp_parent;
-                    break;
-                }
-            }
-            
-        } while(temp_parent != 0);
-        read_dir_from_disk(current_working_block);
-    } else {
+
+    // walk up through "..", finding each name in the parent's index
+    while (dir != sb.root_block) {
+        struct dir_entry parent;
+        if (dir_lookup(dir, "..", parent)) {
+            return -1;
+        }
+        struct dir_index &index = get_dir_index(parent.first_blk);
+        auto it = index.subdirs.find(dir);
+        if (it == index.subdirs.end()) {
+            return -1;
+        }
+        struct dir_entry entry;
+        read_entry(get_slot(index, it->second), entry);
+        path = "/" + std::string(entry.file_name) + path;
+        dir = parent.first_blk;
+    }
+    if (path == "") {
         path = "/";
     }
 
-    std::cout << path << std::endl;
+    out << path << std::endl;
 
     return 0;
 }
@@ -699,11 +2242,258 @@ int FS::pwd()
 // file <filepath> to <accessrights>.
 int FS::chmod(std::string accessrights, std::string filepath)
 {
-    for(struct dir_entry &var : dir_entries){
-        if(std::string(var.file_name) == filepath){
-            var.access_rights = std::stoi(accessrights);
-            break;
+    op_scope scope(this, OP_CHANGE);
+    uint32_t parent;
+    std::string name;
+    struct dir_entry entry;
+    struct dir_slot slot;
+
+    // a number made of READ, WRITE and EXECUTE, e.g. 6 for read and write
+    char *end;
+    unsigned long rights = std::strtoul(accessrights.c_str(), &end, 10);
+    if (accessrights.empty() || !std::isdigit((unsigned char)accessrights[0]) || *end != '\0'
+            || rights > (READ | WRITE | EXECUTE)) {
+        return -1;
+    }
+    do {
+        if (resolve_parent(filepath, parent, name) || name == "..") {
+            return -1;
+        }
+    } while (!lock_dirs({ parent }));
+    if (dir_lookup(parent, name, entry, &slot)) {
+        return -1;
+    }
+    entry.access_rights = rights;
+    dir_update(parent, slot, entry);
+
+    return 0;
+}
+
+// pread <filepath> reads up to len bytes at offset of the file into buf and
+// returns the number of bytes read, 0 at the end of the file
+int FS::pread(std::string filepath, uint32_t offset, uint32_t len, uint8_t *buf)
+{
+    op_scope scope(this, OP_SHARED);
+    struct dir_entry entry;
+    struct dir_slot slot;
+
+    if (find_readable(filepath, entry, &slot)) {
+        return -1;
+    }
+    return read_range(entry, slot, offset, len, buf);
+}
+
+// pwrite <filepath> writes len bytes from buf at offset of the file, growing
+// it if needed, and returns the number of bytes written
+int FS::pwrite(std::string filepath, uint32_t offset, const uint8_t *buf, uint32_t len)
+{
+    op_scope scope(this, OP_CHANGE);
+    uint32_t parent;
+    std::string name;
+    struct dir_entry entry;
+    struct dir_slot slot;
+
+    do {
+        if (resolve_parent(filepath, parent, name)) {
+            return -1;
+        }
+    } while (!lock_dirs({ parent }));
+    if (dir_lookup(parent, name, entry, &slot)) {
+        return -1;
+    }
+    if (entry.type != TYPE_FILE || !(entry.access_rights & WRITE)) {
+        return -1;
+    }
+    return write_range(parent, slot, entry, offset, buf, len);
+}
+
+// open <filepath> opens the file for mode, READ and / or WRITE, and returns
+// a handle to it
+int FS::open(std::string filepath, uint8_t mode)
+{
+    op_scope scope(this, OP_SHARED);
+    struct open_file h;
+    std::string name;
+
+    mode &= READ | WRITE;
+    if (mode == 0 || resolve_parent(filepath, h.parent, name)
+            || dir_lookup(h.parent, name, h.entry, &h.slot)) {
+        return -1;
+    }
+    if (h.entry.type != TYPE_FILE || (h.entry.access_rights & mode) != mode) {
+        return -1;
+    }
+    h.used = true;
+    h.mode = mode;
+    h.offset = 0;
+
+    for (size_t fd = 0; fd < handles.size(); fd++) {
+        if (!handles[fd].used) {
+            handles[fd] = h;
+            return fd;
+        }
+    }
+    if (handles.size() >= MAX_OPEN_FILES) {
+        return -1;
+    }
+    handles.push_back(h);
+    return handles.size() - 1;
+}
+
+// read <fd> reads up to len bytes at the position of the handle into buf
+int FS::read(int fd, uint8_t *buf, uint32_t len)
+{
+    op_scope scope(this, OP_SHARED);
+    struct open_file *h = get_handle(fd);
+    if (!h || !(h->mode & READ)) {
+        return -1;
+    }
+    // a copy, the handle may change while the data is read
+    struct open_file file = *h;
+    int n = read_range(file.entry, file.slot, file.offset, len, buf);
+    h = get_handle(fd);
+    if (n > 0 && h && h->slot.block == file.slot.block && h->slot.index == file.slot.index) {
+        h->offset = file.offset + n;
+    }
+    return n;
+}
+
+// write <fd> writes len bytes from buf at the position of the handle
+int FS::write(int fd, const uint8_t *buf, uint32_t len)
+{
+    op_scope scope(this, OP_CHANGE);
+    struct open_file *h;
+    struct open_file file;
+    do {
+        h = get_handle(fd);
+        if (!h || !(h->mode & WRITE)) {
+            return -1;
         }
+        // a copy, the handle may be closed while the data is written
+        file = *h;
+    } while (!lock_dirs({ file.parent }));
+    int n = write_range(file.parent, file.slot, file.entry, file.offset, buf, len);
+    h = get_handle(fd);
+    if (n > 0 && h && h->slot.block == file.slot.block && h->slot.index == file.slot.index) {
+        h->offset = file.offset + n;
+    }
+    return n;
+}
+
+// seek <fd> sets the position of the handle
+int FS::seek(int fd, uint32_t offset)
+{
+    op_scope scope(this, OP_SHARED);
+    struct open_file *h = get_handle(fd);
+    if (!h) {
+        return -1;
+    }
+    h->offset = offset;
+    return 0;
+}
+
+// close <fd> closes the handle
+int FS::close(int fd)
+{
+    op_scope scope(this, OP_SHARED);
+    struct open_file *h = get_handle(fd);
+    if (!h) {
+        return -1;
+    }
+    h->used = false;
+    return 0;
+}
+
+// stats prints the cache and readahead counters
+int FS::stats(std::ostream &out)
+{
+    op_scope scope(this, OP_SHARED);
+    if (!mounted) {
+        return -1;
+    }
+    out << "disk: " << sb.free_blocks << " of " << sb.no_blocks << " blocks free" << std::endl;
+    out << "cache: " << cache.get_hits() << " hits, " << cache.get_misses() << " misses, "
+        << cache.get_writebacks() << " writebacks" << std::endl;
+    out << "readahead: window " << cache.get_readahead_window() << " blocks, "
+        << cache.get_readahead_blocks() << " blocks read ahead, "
+        << cache.get_readahead_hits() << " used" << std::endl;
+    if (journal.active()) {
+        out << "journal: " << journal.get_size() << " blocks, " << journal.get_commits() << " commits, "
+            << journal.get_logged_blocks() << " blocks logged, "
+            << journal.get_checkpoints() << " checkpoints" << std::endl;
+    }
+    return 0;
+}
+
+// readahead <blocks> sets the largest number of blocks read ahead
+int FS::set_readahead(unsigned blocks)
+{
+    op_scope scope(this);
+    cache.set_readahead_window(blocks);
+    return 0;
+}
+
+// cache <blocks> sets the number of blocks the block cache holds
+int FS::set_cache(unsigned blocks)
+{
+    if (blocks == 0) {
+        return -1;
+    }
+    op_scope scope(this);
+    cache.set_capacity(blocks);
+    return 0;
+}
+
+// sync writes all cached blocks to the disk and flushes the disk file
+int FS::sync()
+{
+    op_scope scope(this);
+    last_sync = std::chrono::steady_clock::now();
+    int ret = write_refcounts();
+    write_fat_to_disk();
+    if (cache.sync() || disk.sync()) {
+        return -1;
     }
+    reuse_freed();
+    std::lock_guard<std::mutex> guard(commit_lock);
+    committed = changes;
+    return ret;
+}
+
+// batch starts collecting the changes of the following operations in memory.
+// The operations run as if nested in one, so nothing is written back when
+// they return.
+int FS::begin_batch()
+{
+    struct fs_client &client = self();
+    if (client.batching) {
+        return -1;
+    }
+    client.batching = true;
+    begin_operation(OP_EXCLUSIVE);
+    return 0;
+}
+
+// commit ends the batch like the end of a single operation
+int FS::commit_batch()
+{
+    struct fs_client &client = self();
+    if (!client.batching) {
+        return -1;
+    }
+    client.batching = false;
+    end_operation();
     return 0;
 }
+
+// durability <level> sets when written blocks are flushed to the disk file
+int FS::set_durability(int level)
+{
+    if (level != DURABILITY_WRITE && level != DURABILITY_OP && level != DURABILITY_SYNC) {
+        return -1;
+    }
+    op_scope scope(this);
+    disk.set_durability(level);
+    cache.set_write_through(level == DURABILITY_WRITE);
+    return sync();
+}
@@ -2,15 +2,29 @@
 #include <cstdint>
 #include <cstring>
 #include <vector>
+#include <set>
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <pthread.h>
 #include "disk.h"
+#include "cache.h"
+#include "journal.h"
+#include "alloc.h"
 
 #ifndef __FS_H__
 #define __FS_H__
 
-#define ROOT_BLOCK 0
-#define FAT_BLOCK 1
+#define SUPER_BLOCK 0
+#define FAT_START 1
 #define FAT_FREE 0
 #define FAT_EOF -1
+#define FAT_ENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(int32_t))
+
+#define FS_MAGIC 0x54414633 // "3FAT"
+#define FS_VERSION 1
 
 #define TYPE_FILE 0
 #define TYPE_DIR 1
@@ -18,49 +32,299 @@
 #define WRITE 0x02
 #define EXECUTE 0x01
 
+// block 0 of a formatted disk, followed by the FAT, the journal and the root
+// directory
+struct superblock {
+    uint32_t magic; // FS_MAGIC
+    uint32_t version; // FS_VERSION
+    uint32_t block_size; // BLOCK_SIZE
+    uint32_t no_blocks; // number of blocks on the disk
+    uint32_t fat_start; // first FAT block
+    uint32_t fat_blocks; // number of FAT blocks, 4 byte entries
+    uint32_t root_block; // first block of the root directory
+    uint32_t refcount_block; // first block of the shared block table, 0 if none
+    uint32_t clean; // 1 if the file system was unmounted cleanly, 0 while mounted
+    uint32_t free_blocks; // number of free blocks, valid when clean or journaled
+    uint32_t journal_start; // first block of the journal
+    uint32_t journal_blocks; // size of the journal, 0 if there is none
+};
+
 struct dir_entry {
     char file_name[56]; // name of the file / sub-directory
     uint32_t size; // size of the file in bytes
-    uint16_t first_blk; // index in the FAT for the first block of the file
-    uint8_t type; // directory (1) or file (0)
-    uint8_t access_rights; // read (0x04), write (0x02), execute (0x01)
+    uint32_t first_blk : 27; // index in the FAT for the first block of the file
+    uint32_t type : 1; // directory (1) or file (0)
+    uint32_t access_rights : 3; // read (0x04), write (0x02), execute (0x01)
+    uint32_t inlined : 1; // the data is stored in the directory, see INLINE_MAX
+};
+
+#define DIR_ENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(struct dir_entry))
+
+// files of at most INLINE_MAX bytes have no data blocks. Their data is kept
+// in the directory slots right after the entry, in the same block. Such a
+// slot starts with INLINE_MARK, the rest of it holds data.
+#define INLINE_MARK 0x01
+#define INLINE_SLOT_DATA (sizeof(struct dir_entry) - 1)
+#define INLINE_MAX_SLOTS 4
+#define INLINE_MAX (INLINE_MAX_SLOTS * INLINE_SLOT_DATA)
+#define DIR_INDEX_CACHE 256 // directories whose name index is kept in memory
+
+// where a directory entry is stored on the disk
+struct dir_slot {
+    uint32_t block;
+    uint32_t index;
+};
+
+// in-memory hash index over the names of one directory. A directory is a FAT
+// chain of blocks, positions count entries from the start of the chain.
+struct dir_index {
+    std::vector<uint32_t> blocks; // the blocks of the directory, in chain order
+    std::unordered_map<std::string, uint32_t> names; // name -> position
+    std::unordered_map<uint32_t, uint32_t> subdirs; // first block of a sub-directory -> position
+    std::set<uint32_t> free_slots; // free positions, lowest first
+};
+
+#define STREAM_BLOCKS 16 // blocks read per request when a file is streamed
+#define COPY_BLOCKS 64 // blocks copied per read/write round by cp
+#define BLOCK_MAP_CACHE 64 // files whose block map is kept in memory
+#define DENTRY_CACHE 4096 // (directory, name) lookups kept in memory
+#define MAX_OPEN_FILES 64 // open file handles, see FS::open
+
+// key of the dentry cache, a name inside the directory starting at block dir
+struct dentry_key {
+    uint32_t dir;
+    std::string name;
+    bool operator==(const dentry_key &other) const { return dir == other.dir && name == other.name; }
+};
+
+struct dentry_key_hash {
+    size_t operator()(const dentry_key &key) const
+    {
+        return std::hash<std::string>()(key.name) ^ ((size_t)key.dir * 0x9e3779b9u);
+    }
+};
+
+// sequential access detection for readahead, see FS::readahead()
+struct readahead_state {
+    uint32_t next = 0; // a read starting here continues the previous one
+    uint32_t ahead = 0; // everything below this index has been read ahead
+    uint32_t window = 0; // blocks to read ahead, doubled by every sequential read
+};
+
+// the blocks of one file as a list of extents, so the block at any index is
+// found with a binary search instead of a walk along the FAT chain
+struct block_map {
+    std::vector<uint32_t> starts; // index in the file of the first block of each extent
+    std::vector<struct extent> extents;
+    uint32_t count = 0; // number of blocks
+    struct readahead_state ra;
+};
+
+// an open file. The entry is resolved and the access rights are checked once
+// by open, later reads and writes use them as they are.
+struct open_file {
+    bool used;
+    uint8_t mode; // READ and / or WRITE
+    uint32_t parent; // directory holding the entry
+    struct dir_slot slot; // where the entry is stored
+    struct dir_entry entry;
+    uint32_t offset; // position of the next read or write
+};
+
+// a cached lookup result: the entry and where it is stored
+struct dentry {
+    struct dir_entry entry;
+    struct dir_slot slot;
+};
+
+// how an operation locks the file system, see FS::begin_operation
+#define OP_SHARED 0 // lookups and reads
+#define OP_CHANGE 1 // changes, locks the directories it changes, see FS::lock_dirs
+#define OP_EXCLUSIVE 2 // format, sync, batches and the commit of changes
+
+// state of one client of the file system, i.e., one thread
+struct fs_client {
+    uint32_t cwd; // first block of the current directory
+    int op_depth; // nesting depth of public operations
+    int mode; // OP_SHARED, OP_CHANGE or OP_EXCLUSIVE, of the outermost operation
+    bool batching; // between begin_batch and commit_batch
+    std::vector<uint32_t> dirs; // directories locked by the operation, by first block
 };
 
 class FS {
 private:
     Disk disk;
-    // size of a FAT entry is 2 bytes
-    int16_t fat[BLOCK_SIZE/2];
-    int8_t current_working_block = 0;
-    struct dir_entry dir_entries[BLOCK_SIZE / sizeof(struct dir_entry)];
+    // metadata blocks written through the cache are logged here first
+    Journal journal;
+    BlockCache cache;
 
+    // Locking. Lookups, reads and changes share ns_lock, and hold state_lock
+    // for the caches they fill or change (name indexes, dentries, block maps,
+    // the FAT) except while file data is transferred, see data_scope. So all
+    // metadata work, directory lookups included, runs one operation at a
+    // time; only data transfers overlap. A change also locks the directories
+    // it changes, so nobody else changes them while it transfers data.
+    // Format, sync, batches and commits hold ns_lock exclusively. The locks
+    // are taken once, by the outermost operation of a client.
+    pthread_rwlock_t ns_lock;
+    std::mutex state_lock;
+    // by first block, directories are never freed so the block stays theirs.
+    // Plain mutexes, only changes take them: lookups and reads are kept
+    // consistent by state_lock, not by these.
+    std::unordered_map<uint32_t, std::mutex> dir_locks;
+    // group commit: changes counts the finished changes, committed how many
+    // of them are committed. The first client to wait commits for everyone.
+    unsigned long changes = 0;
+    unsigned long committed = 0;
+    bool committing = false;
+    std::mutex commit_lock;
+    std::condition_variable commit_done;
+    // clients by thread, each with its own current directory
+    std::mutex clients_lock;
+    std::unordered_map<std::thread::id, struct fs_client> clients;
+    // counts format and mount, blocks allocated before one are stale
+    unsigned generation = 0;
+
+    struct op_scope {
+        FS *fs;
+        op_scope(FS *fs, int mode = OP_EXCLUSIVE) : fs(fs) { fs->begin_operation(mode); }
+        ~op_scope() { fs->end_operation(); }
+    };
+    // lets the other clients in while an operation that is not exclusive
+    // transfers data, unless locked
+    struct data_scope {
+        FS *fs;
+        bool unlocked;
+        data_scope(FS *fs, bool locked = false) : fs(fs), unlocked(!locked && fs->self().mode != OP_EXCLUSIVE) { if (unlocked) fs->state_lock.unlock(); }
+        ~data_scope() { if (unlocked) fs->state_lock.lock(); }
+    };
+    struct fs_client &self();
+    void begin_operation(int mode);
+    void end_operation();
+    bool lock_dirs(std::vector<uint32_t> dirs);
+    void unlock_dirs();
+    void wait_commit(unsigned long seq);
+    void reset_clients();
+    int commit();
+    void reuse_freed();
+    std::chrono::steady_clock::time_point last_sync;
+    // a valid file system was mounted or formatted. Until then every
+    // operation except format fails, see mount().
+    bool mounted = false;
+    struct superblock sb = {};
+    // the free count changed since the superblock was last written
+    bool sb_dirty = false;
+    // size of a FAT entry is 4 bytes. FAT blocks are read from the disk the
+    // first time one of their entries is used, see get_fat().
+    std::vector<int32_t> fat;
+    std::vector<bool> fat_loaded;
+    // FAT blocks changed since they were last written, set by set_fat()
+    std::vector<bool> fat_dirty;
+    struct readahead_state fat_ra;
+    // free blocks of the loaded FAT blocks, kept in step with fat[] by set_fat()
+    FreeMap freemap;
+    // blocks freed since the last commit, kept out of the free map until then
+    std::vector<unsigned> freed;
+    // name indexes of recently used directories, by first block
+    std::unordered_map<uint32_t, struct dir_index> dir_indexes;
+    // resolved path components, so repeated lookups need neither the name
+    // index nor the directory blocks. Kept in step by dir_add, dir_remove
+    // and dir_update.
+    std::unordered_map<struct dentry_key, struct dentry, dentry_key_hash> dentries;
+    // reference counts of shared data blocks, see cp --reflink. A count is
+    // the number of directory entries and FAT entries pointing at the block,
+    // blocks that are not in the table have a single owner. Saved as a
+    // chain of (block, count) pairs starting at sb.refcount_block.
+    std::unordered_map<uint32_t, uint32_t> shared_refs;
+    bool refs_dirty = false;
+    // block maps of recently used files, by first block. Dropped by whoever
+    // changes a chain, see drop_block_map().
+    std::unordered_map<uint32_t, struct block_map> block_maps;
+    // open files, a handle is an index into this table
+    std::vector<struct open_file> handles;
+
+    int mount();
+    void check();
+    int check_chain(int first_block, std::vector<uint32_t> &refs);
+    void write_superblock();
     int find_empty_block();
+    void load_fat_block(unsigned fat_block);
+    int32_t get_fat(unsigned block);
+    void set_fat(unsigned block, int32_t value);
+    int ensure_free_blocks(unsigned count);
     void write_fat_to_disk();
-    void write_dir_to_disk(int block_nr);
-    void read_dir_from_disk(int block_nr);
-    int check_name_exists(std::string filename);
-    int create_file(std::string data, std::string filepath, std::string og_name, uint8_t permissions);
-    std::string read_file(std::string filepath);
-    int move_to_path(std::string path_to_move);
-    bool check_permissions(uint8_t permissions, uint16_t block, bool is_dir);
-    int write_data_to_disk(std::string data);
+    int alloc_blocks(unsigned count, std::vector<int> &blocks, int goal = -1);
+    void free_chain(int first_block);
+    void load_refcounts();
+    int write_refcounts();
+    void add_ref(int block);
+    int unshare_chain(struct dir_entry &entry, unsigned index);
+
+    struct dir_index &get_dir_index(uint32_t dir);
+    struct dir_slot get_slot(struct dir_index &index, uint32_t pos);
+    void read_entry(struct dir_slot slot, struct dir_entry &entry);
+    void write_entry(struct dir_slot slot, const struct dir_entry &entry);
+    int dir_lookup(uint32_t dir, std::string name, struct dir_entry &entry, struct dir_slot *slot = nullptr);
+    int dir_add(uint32_t dir, const struct dir_entry &entry, const std::string &data = "");
+    int dir_remove(uint32_t dir, std::string name);
+    void dir_update(uint32_t dir, struct dir_slot slot, const struct dir_entry &entry);
+    struct open_file *get_handle(int fd);
+    bool is_open(struct dir_slot slot);
+    void dentry_insert(uint32_t dir, std::string name, const struct dir_entry &entry, struct dir_slot slot);
+    int dir_grow(struct dir_index &index);
+    void dir_list(uint32_t dir, std::vector<struct dir_entry> &entries);
+    uint8_t dir_rights(uint32_t dir);
+    bool valid_name(std::string name);
+    int read_inline(struct dir_slot slot, const struct dir_entry &entry, std::string &data);
+    int promote_inline(uint32_t parent, struct dir_slot slot, struct dir_entry &entry);
+
+    int resolve_dir(std::string path, uint32_t &dir);
+    int resolve_parent(std::string path, uint32_t &parent, std::string &name);
+    int resolve_target(std::string sourcepath, std::string destpath, uint32_t &parent, std::string &name);
+    int create_file(std::string data, uint32_t parent, std::string name, uint8_t permissions, const std::vector<int> *blocks = nullptr);
+    int link_file(uint32_t parent, std::string name, int first_block, uint32_t size, uint8_t permissions);
+    int copy_chain(int src_first, uint32_t size);
+    int find_readable(std::string filepath, struct dir_entry &entry, struct dir_slot *slot = nullptr);
+    int read_file(std::string filepath, std::string &data);
+    int stream_chain(int first_block, uint32_t size, std::ostream &out);
+    struct block_map &get_block_map(int first_block);
+    void drop_block_map(int first_block);
+    int map_block(const struct block_map &map, unsigned index);
+    void map_range(const struct block_map &map, unsigned first, unsigned last, std::vector<int> &blocks);
+    void map_append(struct block_map &map, int block);
+    bool readahead(struct readahead_state &ra, unsigned first, unsigned last, unsigned limit, unsigned &from, unsigned &to);
+    int read_range(const struct dir_entry &entry, struct dir_slot slot, uint32_t offset, uint32_t len, uint8_t *buf);
+    int write_range(uint32_t parent, struct dir_slot slot, struct dir_entry &entry, uint32_t offset, const uint8_t *buf, uint32_t len);
+    int read_chain(int first_block, uint32_t size, std::string &data);
+    int write_data_to_disk(std::string data, int goal = -1, bool locked = false);
+    int write_data_blocks(const std::string &data, std::vector<int> &blocks, int goal = -1, bool locked = false);
+    int link_blocks(const std::vector<int> &blocks);
+    void release_blocks(const std::vector<int> &blocks);
 
 public:
-    FS();
+    FS(int disk_backend = DISK_BACKEND, unsigned cache_blocks = CACHE_CAPACITY);
     ~FS();
-    // formats the disk, i.e., creates an empty file system
-    int format();
+    // formats the disk, i.e., creates an empty file system. The disk file is
+    // resized to no_blocks blocks first, unless no_blocks is 0.
+    int format(unsigned no_blocks = 0);
     // create <filepath> creates a new file on the disk, the data content is
     // written on the following rows (ended with an empty row)
     int create(std::string filepath);
-    // cat <filepath> reads the content of a file and prints it on the screen
-    int cat(std::string filepath);
-    // ls lists the content in the current directory (files and sub-directories)
-    int ls();
+    // creates the file filepath with the content data. The data is written
+    // before the directory is locked, so clients can create files at once.
+    int create(std::string filepath, const std::string &data);
+    // cat <filepath> reads the content of a file and prints it on the screen,
+    // or writes it to out
+    int cat(std::string filepath, std::ostream &out = std::cout);
+    // ls lists the content in the current directory (files and sub-directories),
+    // on the screen or to out
+    int ls(std::ostream &out = std::cout);
 
     // cp <sourcepath> <destpath> makes an exact copy of the file
     // <sourcepath> to a new file <destpath>
-    int cp(std::string sourcepath, std::string destpath);
+    // With reflink the copy shares the blocks of <sourcepath>, a shared block
+    // is only copied when one of the files is changed.
+    int cp(std::string sourcepath, std::string destpath, bool reflink = false);
     // mv <sourcepath> <destpath> renames the file <sourcepath> to the name <destpath>,
     // or moves the file <sourcepath> to the directory <destpath> (if dest is a directory)
     int mv(std::string sourcepath, std::string destpath);
@@ -77,11 +341,61 @@ public:
     int cd(std::string dirpath);
     // pwd prints the full path, i.e., from the root directory, to the current
     // directory, including the current directory name
-    int pwd();
+    int pwd(std::ostream &out = std::cout);
 
     // chmod <accessrights> <filepath> changes the access rights for the
     // file <filepath> to <accessrights>.
     int chmod(std::string accessrights, std::string filepath);
+
+    // pread <filepath> reads up to len bytes at offset of the file into buf
+    // and returns the number of bytes read, 0 at the end of the file
+    int pread(std::string filepath, uint32_t offset, uint32_t len, uint8_t *buf);
+    // pwrite <filepath> writes len bytes from buf at offset of the file,
+    // growing it if needed, and returns the number of bytes written
+    int pwrite(std::string filepath, uint32_t offset, const uint8_t *buf, uint32_t len);
+
+    // open <filepath> opens the file for mode, READ and / or WRITE, and returns
+    // a handle to it. The access rights are only checked here.
+    int open(std::string filepath, uint8_t mode = READ);
+    // read <fd> reads up to len bytes at the position of the handle into buf,
+    // moves the position and returns the number of bytes read
+    int read(int fd, uint8_t *buf, uint32_t len);
+    // write <fd> writes len bytes from buf at the position of the handle,
+    // moves the position and returns the number of bytes written
+    int write(int fd, const uint8_t *buf, uint32_t len);
+    // seek <fd> sets the position of the handle
+    int seek(int fd, uint32_t offset);
+    // close <fd> closes the handle
+    int close(int fd);
+
+    // stats prints the cache and readahead counters
+    int stats(std::ostream &out = std::cout);
+    // readahead <blocks> sets the largest number of blocks read ahead of a
+    // sequential reader, 0 turns readahead off
+    int set_readahead(unsigned blocks);
+    // cache <blocks> sets how many blocks the block cache holds, dirty blocks
+    // above the new size are written back
+    int set_cache(unsigned blocks);
+
+    // sync writes all cached blocks to the disk and flushes the disk file
+    int sync();
+    // durability <level> sets when written blocks are flushed to the disk file,
+    // one of DURABILITY_WRITE, DURABILITY_OP or DURABILITY_SYNC
+    int set_durability(int level);
+    int get_durability() { return disk.get_durability(); }
+    // batch defers writing the FAT and the directories until commit, so a
+    // run of operations writes each changed block once
+    int begin_batch();
+    // commit ends the batch and writes the changed blocks, as one journal
+    // transaction if there is a journal and the changes fit in it
+    int commit_batch();
+    // forgets the calling thread, e.g., when a client disconnects. Its next
+    // operation starts in the root directory.
+    void detach();
+    // the current directory of the calling thread, so another thread can
+    // resolve relative paths as this one would, see AsyncFS
+    uint32_t get_cwd();
+    void set_cwd(uint32_t dir);
 };
 
 #endif // __FS_H__
\ No newline at end of file
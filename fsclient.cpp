@@ -0,0 +1,149 @@
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "fsclient.h"
+
+#define FSCLIENT_READ_SIZE 65536 // bytes received at once
+
+FSClient::~FSClient()
+{
+    disconnect();
+}
+
+int
+FSClient::connect(const std::string &socket_path)
+{
+    struct sockaddr_un addr;
+    if (fd != -1 || socket_path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        disconnect();
+        return -1;
+    }
+    return 0;
+}
+
+void
+FSClient::disconnect()
+{
+    if (fd != -1) {
+        close(fd);
+    }
+    fd = -1;
+    out.clear();
+    in.clear();
+    pending = 0;
+}
+
+uint32_t
+FSClient::submit(uint16_t op, const std::string &path, const std::string &path2,
+                 const std::string &data, uint32_t offset, uint32_t count, uint16_t flags)
+{
+    struct fsd_request req;
+    req.tag = next_tag++;
+    req.op = op;
+    req.flags = flags;
+    req.path_len = path.size();
+    req.path2_len = path2.size();
+    req.offset = offset;
+    req.count = count;
+    req.data_len = data.size();
+    out.append(reinterpret_cast<const char *>(&req), sizeof(req));
+    out.append(path);
+    out.append(path2);
+    out.append(data);
+    pending++;
+    return req.tag;
+}
+
+// reads what has arrived into in, -1 if fsd went away
+int
+FSClient::receive()
+{
+    char buf[FSCLIENT_READ_SIZE];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+        return -1;
+    }
+    in.append(buf, n);
+    return 0;
+}
+
+int
+FSClient::flush()
+{
+    size_t sent = 0;
+    while (sent < out.size()) {
+        struct pollfd pfd = { fd, POLLIN | POLLOUT, 0 };
+        if (fd == -1 || poll(&pfd, 1, -1) == -1) {
+            return -1;
+        }
+        if ((pfd.revents & POLLIN) && receive()) {
+            return -1;
+        }
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return -1;
+            }
+            sent += n;
+        }
+        if (pfd.revents & (POLLERR | POLLHUP)) {
+            return -1;
+        }
+    }
+    out.clear();
+    return 0;
+}
+
+int
+FSClient::next_reply(struct fsd_result &result)
+{
+    if (pending == 0 || flush()) {
+        return -1;
+    }
+    struct fsd_reply reply;
+    while (in.size() < sizeof(reply)
+            || in.size() < sizeof(reply) + reinterpret_cast<const struct fsd_reply *>(in.data())->data_len) {
+        if (receive()) {
+            return -1;
+        }
+    }
+    std::memcpy(&reply, in.data(), sizeof(reply));
+    result.tag = reply.tag;
+    result.status = reply.status;
+    result.data = in.substr(sizeof(reply), reply.data_len);
+    in.erase(0, sizeof(reply) + reply.data_len);
+    pending--;
+    return 0;
+}
+
+// sends one request and waits for its reply. Fails while submitted requests
+// are waiting for their replies, those belong to next_reply().
+int
+FSClient::call(uint16_t op, const std::string &path, const std::string &path2,
+               const std::string &data, std::string *reply, uint32_t offset, uint32_t count, uint16_t flags)
+{
+    if (pending) {
+        return -1;
+    }
+    submit(op, path, path2, data, offset, count, flags);
+    struct fsd_result result;
+    if (next_reply(result)) {
+        return -1;
+    }
+    if (reply) {
+        *reply = result.data;
+    }
+    return result.status;
+}
@@ -0,0 +1,70 @@
+#include <cstdint>
+#include <string>
+#include "fsd.h"
+
+#ifndef __FSCLIENT_H__
+#define __FSCLIENT_H__
+
+// the reply to one request
+struct fsd_result {
+    uint32_t tag;
+    int status;
+    std::string data;
+};
+
+// client of fsd. Requests are queued with submit() and sent with flush(),
+// so many of them can be in flight at once; their replies are collected in
+// order with next_reply(). The other methods send one request and wait for
+// its reply, with the return value of the FS method of the same name. They
+// fail while submitted requests still wait for their replies.
+class FSClient {
+private:
+    int fd = -1;
+    uint32_t next_tag = 0;
+    std::string out; // requests not sent yet
+    std::string in; // received bytes not returned by next_reply yet
+    unsigned pending = 0; // requests sent or queued without a reply
+
+    int receive();
+    int call(uint16_t op, const std::string &path = "", const std::string &path2 = "",
+             const std::string &data = "", std::string *reply = nullptr, uint32_t offset = 0,
+             uint32_t count = 0, uint16_t flags = 0);
+public:
+    FSClient() {}
+    ~FSClient();
+    // connects to fsd listening on socket_path
+    int connect(const std::string &socket_path = FSD_SOCKET);
+    void disconnect();
+    // queues a request and returns its tag
+    uint32_t submit(uint16_t op, const std::string &path = "", const std::string &path2 = "",
+                    const std::string &data = "", uint32_t offset = 0, uint32_t count = 0,
+                    uint16_t flags = 0);
+    // sends the queued requests. Replies arriving meanwhile are kept, so a
+    // long pipeline does not block on a full socket.
+    int flush();
+    // waits for the reply to the oldest request without one
+    int next_reply(struct fsd_result &result);
+    unsigned get_pending() { return pending; }
+
+    int format() { return call(FSD_FORMAT); }
+    int create(const std::string &filepath, const std::string &data) { return call(FSD_CREATE, filepath, "", data); }
+    int cat(const std::string &filepath, std::string &output) { return call(FSD_CAT, filepath, "", "", &output); }
+    int ls(std::string &output) { return call(FSD_LS, "", "", "", &output); }
+    int cp(const std::string &sourcepath, const std::string &destpath, bool reflink = false)
+        { return call(FSD_CP, sourcepath, destpath, "", nullptr, 0, 0, reflink ? FSD_REFLINK : 0); }
+    int mv(const std::string &sourcepath, const std::string &destpath) { return call(FSD_MV, sourcepath, destpath); }
+    int rm(const std::string &filepath) { return call(FSD_RM, filepath); }
+    int append(const std::string &filepath1, const std::string &filepath2) { return call(FSD_APPEND, filepath1, filepath2); }
+    int mkdir(const std::string &dirpath) { return call(FSD_MKDIR, dirpath); }
+    int cd(const std::string &dirpath) { return call(FSD_CD, dirpath); }
+    int pwd(std::string &output) { return call(FSD_PWD, "", "", "", &output); }
+    int chmod(const std::string &accessrights, const std::string &filepath) { return call(FSD_CHMOD, filepath, accessrights); }
+    int pread(const std::string &filepath, uint32_t offset, uint32_t len, std::string &data)
+        { return call(FSD_PREAD, filepath, "", "", &data, offset, len); }
+    int pwrite(const std::string &filepath, uint32_t offset, const std::string &data)
+        { return call(FSD_PWRITE, filepath, "", data, nullptr, offset); }
+    int sync() { return call(FSD_SYNC); }
+    int stats(std::string &output) { return call(FSD_STATS, "", "", "", &output); }
+};
+
+#endif // __FSCLIENT_H__
@@ -0,0 +1,248 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <exception>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "fs.h"
+#include "fsd.h"
+
+// fsd [socket] serves the file system in diskfile.bin to local clients over
+// a Unix domain socket. Every connection gets its own thread, and with it
+// its own current directory. SIGINT or SIGTERM unmounts cleanly.
+
+#define FSD_READ_SIZE 65536 // bytes received at once
+#define FSD_ACCEPT_BACKOFF 100 // ms to wait when out of file descriptors
+
+static volatile sig_atomic_t stopping = 0;
+
+// the open connections, so they can be shut down on exit
+static std::mutex conns_lock;
+static std::condition_variable conns_done;
+static std::set<int> conns;
+
+static void
+stop(int)
+{
+    stopping = 1;
+}
+
+// sends all of len bytes, false if the client went away
+static bool
+send_all(int fd, const uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// runs one request and returns its status, output goes to data
+static int
+execute(FS &fs, const struct fsd_request &req, const std::string &path, const std::string &path2,
+        const std::string &in, std::string &data)
+{
+    std::ostringstream out;
+    int ret = -1;
+    switch (req.op) {
+    case FSD_FORMAT:
+        return fs.format();
+    case FSD_CREATE:
+        return fs.create(path, in);
+    case FSD_CAT:
+        ret = fs.cat(path, out);
+        break;
+    case FSD_LS:
+        ret = fs.ls(out);
+        break;
+    case FSD_CP:
+        return fs.cp(path, path2, req.flags & FSD_REFLINK);
+    case FSD_MV:
+        return fs.mv(path, path2);
+    case FSD_RM:
+        return fs.rm(path);
+    case FSD_APPEND:
+        return fs.append(path, path2);
+    case FSD_MKDIR:
+        return fs.mkdir(path);
+    case FSD_CD:
+        return fs.cd(path);
+    case FSD_PWD:
+        ret = fs.pwd(out);
+        break;
+    case FSD_CHMOD:
+        return fs.chmod(path2, path);
+    case FSD_PREAD:
+        if (req.count > FSD_MAX_DATA) {
+            return -1;
+        }
+        data.resize(req.count);
+        ret = fs.pread(path, req.offset, req.count, reinterpret_cast<uint8_t *>(&data[0]));
+        data.resize(ret > 0 ? ret : 0);
+        return ret;
+    case FSD_PWRITE:
+        return fs.pwrite(path, req.offset, reinterpret_cast<const uint8_t *>(in.data()), in.size());
+    case FSD_SYNC:
+        return fs.sync();
+    case FSD_STATS:
+        ret = fs.stats(out);
+        break;
+    }
+    data = out.str();
+    return ret;
+}
+
+// serves one connection. All complete requests received so far are run in
+// order, their replies are sent together.
+static void
+serve(FS &fs, int fd)
+{
+    std::vector<uint8_t> in;
+    std::string out;
+    uint8_t buf[FSD_READ_SIZE];
+    size_t pos = 0;
+    bool open = true;
+
+    // signals are for the main thread, to interrupt accept()
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    while (open) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            break;
+        }
+        in.insert(in.end(), buf, buf + n);
+
+        for (;;) {
+            struct fsd_request req;
+            if (in.size() - pos < sizeof(req)) {
+                break;
+            }
+            std::memcpy(&req, in.data() + pos, sizeof(req));
+            if (req.path_len > FSD_MAX_PATH || req.path2_len > FSD_MAX_PATH || req.data_len > FSD_MAX_DATA) {
+                open = false;
+                break;
+            }
+            size_t len = sizeof(req) + req.path_len + req.path2_len + req.data_len;
+            if (in.size() - pos < len) {
+                break;
+            }
+            const char *p = reinterpret_cast<const char *>(in.data() + pos + sizeof(req));
+            std::string path(p, req.path_len);
+            std::string path2(p + req.path_len, req.path2_len);
+            std::string data_in(p + req.path_len + req.path2_len, req.data_len);
+            pos += len;
+
+            std::string data;
+            struct fsd_reply reply;
+            reply.tag = req.tag;
+            // a failed request must not take the other clients down
+            try {
+                reply.status = execute(fs, req, path, path2, data_in, data);
+            } catch (const std::exception &) {
+                reply.status = -1;
+                data.clear();
+            }
+            reply.data_len = data.size();
+            out.append(reinterpret_cast<const char *>(&reply), sizeof(reply));
+            out.append(data);
+        }
+        in.erase(in.begin(), in.begin() + pos);
+        pos = 0;
+
+        if (!out.empty() && !send_all(fd, reinterpret_cast<const uint8_t *>(out.data()), out.size())) {
+            break;
+        }
+        out.clear();
+    }
+    fs.detach();
+
+    std::lock_guard<std::mutex> guard(conns_lock);
+    conns.erase(fd);
+    close(fd);
+    conns_done.notify_all();
+}
+
+int
+main(int argc, char **argv)
+{
+    std::string socket_path = argc > 1 ? argv[1] : FSD_SOCKET;
+    struct sockaddr_un addr;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "fsd: socket path too long\n";
+        return 1;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(socket_path.c_str());
+    if (listen_fd == -1 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1
+            || listen(listen_fd, SOMAXCONN) == -1) {
+        std::cerr << "fsd: can't listen on " << socket_path << std::endl;
+        return 1;
+    }
+
+    // accept() is interrupted, not restarted, when a signal arrives
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    {
+        FS fs;
+        std::cout << "fsd: serving " << DISKNAME << " on " << socket_path << std::endl;
+        while (!stopping) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd == -1) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                // the connections will free some, retrying at once would spin
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(FSD_ACCEPT_BACKOFF));
+                    continue;
+                }
+                std::cerr << "fsd: accept failed: " << std::strerror(errno) << std::endl;
+                break;
+            }
+            std::lock_guard<std::mutex> guard(conns_lock);
+            conns.insert(fd);
+            std::thread(serve, std::ref(fs), fd).detach();
+        }
+        // wake up the connections and wait until they have finished their
+        // last requests
+        std::unique_lock<std::mutex> guard(conns_lock);
+        for (int fd : conns) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        while (!conns.empty()) {
+            conns_done.wait(guard);
+        }
+        std::cout << "fsd: unmounting\n";
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    return 0;
+}
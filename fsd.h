@@ -0,0 +1,53 @@
+#include <cstdint>
+
+#ifndef __FSD_H__
+#define __FSD_H__
+
+// binary protocol between fsd and its clients, see fsclient.h. A client
+// sends requests, each a header followed by path, path2 and data, and may
+// send many before it reads any reply. The replies come in request order,
+// each a header followed by data. All fields are in host byte order, fsd
+// only listens on a local socket.
+
+#define FSD_SOCKET "fsd.sock" // default socket path
+#define FSD_MAX_PATH 4096 // longest path in a request
+#define FSD_MAX_DATA (64u << 20) // most data in a request or a reply
+
+// operations, the arguments each one uses are listed
+#define FSD_FORMAT 1 //
+#define FSD_CREATE 2 // path, data
+#define FSD_CAT 3 // path, the reply holds the output of cat
+#define FSD_LS 4 // the reply holds the output of ls
+#define FSD_CP 5 // path, path2, flags FSD_REFLINK
+#define FSD_MV 6 // path, path2
+#define FSD_RM 7 // path
+#define FSD_APPEND 8 // path, path2
+#define FSD_MKDIR 9 // path
+#define FSD_CD 10 // path
+#define FSD_PWD 11 // the reply holds the output of pwd
+#define FSD_CHMOD 12 // path, path2 holds the access rights
+#define FSD_PREAD 13 // path, offset, count, the reply holds the bytes read
+#define FSD_PWRITE 14 // path, offset, data
+#define FSD_SYNC 15 //
+#define FSD_STATS 16 // the reply holds the output of stats
+
+#define FSD_REFLINK 0x01 // cp shares the blocks of the source
+
+struct fsd_request {
+    uint32_t tag; // chosen by the client, returned in the reply
+    uint16_t op; // one of the FSD_ operations
+    uint16_t flags;
+    uint32_t path_len;
+    uint32_t path2_len;
+    uint32_t offset;
+    uint32_t count;
+    uint32_t data_len;
+};
+
+struct fsd_reply {
+    uint32_t tag;
+    int32_t status; // the return value of the FS method, -1 on error
+    uint32_t data_len;
+};
+
+#endif // __FSD_H__
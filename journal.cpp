@@ -0,0 +1,228 @@
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include "journal.h"
+
+// FNV-1a over the block numbers and images of a transaction
+static uint32_t
+checksum(const struct journal_desc *desc, const uint8_t *images)
+{
+    uint32_t hash = 2166136261u ^ desc->seq;
+    const uint8_t *parts[2] = { reinterpret_cast<const uint8_t*>(desc->blocks), images };
+    size_t lengths[2] = { desc->count * sizeof(uint32_t), (size_t)desc->count * BLOCK_SIZE };
+    for (int p = 0; p < 2; p++) {
+        for (size_t i = 0; i < lengths[p]; i++) {
+            hash = (hash ^ parts[p][i]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+// positions skipped at the end of the region, a transaction is never split
+unsigned
+Journal::wasted(unsigned count)
+{
+    return head + count + 1 > size ? size - head : 0;
+}
+
+int
+Journal::write_header()
+{
+    uint8_t block[BLOCK_SIZE] = {0};
+    struct journal_header *header = reinterpret_cast<struct journal_header*>(block);
+    header->magic = JOURNAL_MAGIC;
+    header->seq = seq;
+    header->start = head;
+    return disk.write(start, block);
+}
+
+// reads the transaction at pos into buf, its descriptor first. Fails unless
+// it is the next one in sequence and complete.
+int
+Journal::read_transaction(unsigned pos, std::vector<uint8_t> &buf)
+{
+    buf.resize(BLOCK_SIZE);
+    if (disk.read(start + pos, buf.data())) {
+        return -1;
+    }
+    struct journal_desc desc;
+    std::memcpy(&desc, buf.data(), sizeof(desc));
+    if (desc.magic != JOURNAL_MAGIC || desc.seq != seq || desc.count == 0
+            || desc.count > JOURNAL_DESC_BLOCKS || pos + desc.count + 1 > size) {
+        return -1;
+    }
+    buf.resize((size_t)(desc.count + 1) * BLOCK_SIZE);
+    if (disk.readv(start + pos + 1, desc.count, buf.data() + BLOCK_SIZE)) {
+        return -1;
+    }
+    if (checksum(&desc, buf.data() + BLOCK_SIZE) != desc.checksum) {
+        return -1;
+    }
+    return 0;
+}
+
+// sets up an empty journal in blocks [start, start + size). The region is
+// zeroed, so nothing left from an earlier file system can be replayed.
+int
+Journal::create(unsigned start, unsigned size)
+{
+    this->start = start;
+    this->size = size;
+    seq = 1;
+    head = 1;
+    used = 0;
+    logged.clear();
+    std::vector<uint8_t> zero((size_t)size * BLOCK_SIZE, 0);
+    if (disk.writev(start, size, zero.data()) || write_header() || disk.sync()) {
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+// opens the journal and writes the blocks of every complete transaction
+// since the last checkpoint to their place
+int
+Journal::open(unsigned start, unsigned size)
+{
+    uint8_t block[BLOCK_SIZE];
+    this->start = start;
+    this->size = size;
+    used = 0;
+    logged.clear();
+    struct journal_header header;
+    if (disk.read(start, block)) {
+        close();
+        return -1;
+    }
+    std::memcpy(&header, block, sizeof(header));
+    if (header.magic != JOURNAL_MAGIC) {
+        close();
+        return -1;
+    }
+    seq = header.seq;
+    head = header.start >= 1 && header.start < size ? header.start : 1;
+
+    int replayed = 0;
+    std::vector<uint8_t> buf;
+    for (;;) {
+        // the next transaction may have been written at the start of the
+        // region, if it did not fit at the end
+        if (read_transaction(head, buf)) {
+            if (head == 1 || read_transaction(1, buf)) {
+                break;
+            }
+            head = 1;
+        }
+        struct journal_desc *desc = reinterpret_cast<struct journal_desc*>(buf.data());
+        for (unsigned i = 0; i < desc->count; i++) {
+            if (disk.write(desc->blocks[i], buf.data() + (size_t)(i + 1) * BLOCK_SIZE)) {
+                close();
+                return -1;
+            }
+        }
+        head += desc->count + 1;
+        if (head >= size) {
+            head = 1;
+        }
+        seq++;
+        replayed++;
+    }
+    if (disk.sync() || write_header() || disk.sync()) {
+        close();
+        return -1;
+    }
+    return replayed;
+}
+
+void
+Journal::close()
+{
+    size = 0;
+    used = 0;
+    logged.clear();
+}
+
+bool
+Journal::fits(unsigned count)
+{
+    return fits_empty(count) && used + wasted(count) + count + 1 <= size - 1;
+}
+
+bool
+Journal::fits_empty(unsigned count)
+{
+    return count <= JOURNAL_DESC_BLOCKS && count + 2 <= size;
+}
+
+// writes the descriptor and the images with one request and flushes them
+int
+Journal::commit(const std::vector<unsigned> &block_nos, const std::vector<uint8_t*> &images)
+{
+    unsigned count = block_nos.size();
+    if (count == 0) {
+        return 0;
+    }
+    if (!fits(count)) {
+        return -1;
+    }
+    unsigned skip = wasted(count);
+    if (skip) {
+        head = 1;
+        used += skip;
+    }
+
+    std::vector<uint8_t> desc_block(BLOCK_SIZE, 0);
+    std::vector<uint8_t> image_buf((size_t)count * BLOCK_SIZE);
+    struct journal_desc *desc = reinterpret_cast<struct journal_desc*>(desc_block.data());
+    desc->magic = JOURNAL_MAGIC;
+    desc->seq = seq;
+    desc->count = count;
+    std::vector<uint8_t*> blks(1, desc_block.data());
+    for (unsigned i = 0; i < count; i++) {
+        desc->blocks[i] = block_nos[i];
+        std::memcpy(image_buf.data() + (size_t)i * BLOCK_SIZE, images[i], BLOCK_SIZE);
+        blks.push_back(image_buf.data() + (size_t)i * BLOCK_SIZE);
+    }
+    desc->checksum = checksum(desc, image_buf.data());
+    if (disk.writev(start + head, blks.data(), blks.size()) || disk.sync()) {
+        return -1;
+    }
+
+    unsigned pos = head;
+    head += count + 1;
+    if (head >= size) {
+        head = 1;
+    }
+    used += count + 1;
+    seq++;
+    for (unsigned i = 0; i < count; i++) {
+        logged[block_nos[i]] = pos + 1 + i;
+    }
+    commits++;
+    logged_blocks += count;
+    return 0;
+}
+
+int
+Journal::read_logged(unsigned block_no, uint8_t *blk)
+{
+    auto it = logged.find(block_no);
+    if (it == logged.end()) {
+        return -1;
+    }
+    return disk.read(start + it->second, blk);
+}
+
+// moves the start of the journal up to the next transaction
+int
+Journal::checkpoint()
+{
+    if (write_header() || disk.sync()) {
+        return -1;
+    }
+    used = 0;
+    logged.clear();
+    checkpoints++;
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "disk.h"
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#define JOURNAL_MAGIC 0x4c4e524a // "JRNL"
+#define JOURNAL_BLOCKS 128 // size of the journal on a new disk, at most 1/8 of it
+#define JOURNAL_MIN_BLOCKS 8 // smaller disks get no journal
+// block numbers in the descriptor of one transaction
+#define JOURNAL_DESC_BLOCKS ((BLOCK_SIZE - 4 * sizeof(uint32_t)) / sizeof(uint32_t))
+
+// first block of the journal region
+struct journal_header {
+    uint32_t magic; // JOURNAL_MAGIC
+    uint32_t seq; // sequence number of the oldest transaction to replay
+    uint32_t start; // position of that transaction in the region
+};
+
+// first block of a transaction, followed by the images of its blocks. A
+// transaction only counts if the checksum over the images matches.
+struct journal_desc {
+    uint32_t magic; // JOURNAL_MAGIC
+    uint32_t seq; // sequence number of the transaction
+    uint32_t count; // number of block images that follow
+    uint32_t checksum;
+    uint32_t blocks[JOURNAL_DESC_BLOCKS]; // where the images belong
+};
+
+// circular write-ahead log of metadata blocks. A transaction is written in
+// one request and flushed once, the blocks themselves are written to their
+// place later. Once all of them are there the journal is checkpointed, i.e.,
+// emptied. Mounting replays the transactions written since the last
+// checkpoint.
+class Journal {
+private:
+    Disk &disk;
+    unsigned start = 0; // first block of the region, holds the header
+    unsigned size = 0; // blocks in the region, 0 without a journal
+    uint32_t seq = 0; // sequence number of the next transaction
+    unsigned head = 1; // position of the next transaction
+    unsigned used = 0; // positions used since the last checkpoint
+    // blocks with an image in the journal since the last checkpoint, and
+    // the position of their latest image
+    std::unordered_map<unsigned, unsigned> logged;
+    unsigned long commits = 0;
+    unsigned long logged_blocks = 0;
+    unsigned long checkpoints = 0;
+
+    unsigned wasted(unsigned count);
+    int write_header();
+    int read_transaction(unsigned pos, std::vector<uint8_t> &buf);
+public:
+    Journal(Disk &disk) : disk(disk) {}
+    bool active() { return size > 0; }
+    // sets up an empty journal in blocks [start, start + size)
+    int create(unsigned start, unsigned size);
+    // opens the journal in blocks [start, start + size) and replays it.
+    // Returns the number of transactions replayed, or -1.
+    int open(unsigned start, unsigned size);
+    // detaches from the disk, nothing is logged any more
+    void close();
+    // true if a transaction of count blocks fits in the free part
+    bool fits(unsigned count);
+    // true if a transaction of count blocks fits in an empty journal
+    bool fits_empty(unsigned count);
+    // writes and flushes one transaction, images[i] belongs at block_nos[i]
+    int commit(const std::vector<unsigned> &block_nos, const std::vector<uint8_t*> &images);
+    // empties the journal, all logged blocks must be on the disk already
+    int checkpoint();
+    bool is_logged(unsigned block_no) { return logged.count(block_no) > 0; }
+    // reads the latest logged image of block_no
+    int read_logged(unsigned block_no, uint8_t *blk);
+    unsigned long get_commits() { return commits; }
+    unsigned long get_logged_blocks() { return logged_blocks; }
+    unsigned long get_checkpoints() { return checkpoints; }
+    unsigned get_size() { return size; }
+    unsigned get_used() { return used; }
+};
+
+#endif // __JOURNAL_H__
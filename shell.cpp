@@ -2,6 +2,7 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <cstdlib>
 #include "shell.h"
 #include "fs.h"
 
@@ -10,6 +11,8 @@ std::string commands_str[] = {
     "cp", "mv", "rm", "append",
     "mkdir", "cd", "pwd",
     "chmod",
+    "sync", "durability", "stats", "readahead", "cache",
+    "batch", "commit",
     "help", "quit"
 };
 
@@ -66,12 +69,15 @@ Shell::run()
         }
 
         if (cmd == "format") {
-            if (cmd_line.size() != 1) {
-                std::cout << "Usage: format\n";
+            if (cmd_line.size() != 1 && cmd_line.size() != 2) {
+                std::cout << "Usage: format [no_blocks]\n";
                 continue;
             }
+            unsigned no_blocks = 0;
+            if (cmd_line.size() == 2)
+                no_blocks = std::strtoul(cmd_line[1].c_str(), nullptr, 10);
             // check return value so everything is ok
-            ret_val = filesystem.format();
+            ret_val = filesystem.format(no_blocks);
             if (ret_val) {
                 std::cout << "Error: format failed, error code " << ret_val << std::endl;
             }
@@ -119,14 +125,15 @@ Shell::run()
         }
 
         else if (cmd == "cp") {
-            if (cmd_line.size() != 3) {
-                std::cout << "Usage: <oldfile> <newfile>\n";
+            bool reflink = cmd_line.size() == 4 && cmd_line[1] == "--reflink";
+            if (cmd_line.size() != 3 && !reflink) {
+                std::cout << "Usage: cp [--reflink] <oldfile> <newfile>\n";
                 continue;
             }
-            arg1 = cmd_line[1];
-            arg2 = cmd_line[2];
+            arg1 = cmd_line[cmd_line.size() - 2];
+            arg2 = cmd_line[cmd_line.size() - 1];
             // check return value so everything is ok
-            ret_val = filesystem.cp(arg1, arg2);
+            ret_val = filesystem.cp(arg1, arg2, reflink);
             if (ret_val) {
                 std::cout << "Error: cp " << arg1 << " " << arg2;
                 std::cout << " failed, error code " << ret_val << std::endl;
@@ -232,12 +239,105 @@ Shell::run()
             }
         }
 
+        else if (cmd == "sync") {
+            if (cmd_line.size() != 1) {
+                std::cout << "Usage: sync\n";
+                continue;
+            }
+            // check return value so everything is ok
+            ret_val = filesystem.sync();
+            if (ret_val) {
+                std::cout << "Error: sync failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "durability") {
+            if (cmd_line.size() != 2) {
+                std::cout << "Usage: durability <write|op|sync>\n";
+                continue;
+            }
+            arg1 = cmd_line[1];
+            int level = -1;
+            if (arg1 == "write")
+                level = DURABILITY_WRITE;
+            else if (arg1 == "op")
+                level = DURABILITY_OP;
+            else if (arg1 == "sync")
+                level = DURABILITY_SYNC;
+            // check return value so everything is ok
+            ret_val = filesystem.set_durability(level);
+            if (ret_val) {
+                std::cout << "Error: durability " << arg1;
+                std::cout << " failed, error code " << ret_val << std::endl;
+            }
+        }
+        else if (cmd == "stats") {
+            if (cmd_line.size() != 1) {
+                std::cout << "Usage: stats\n";
+                continue;
+            }
+            // check return value so everything is ok
+            ret_val = filesystem.stats();
+            if (ret_val) {
+                std::cout << "Error: stats failed, error code " << ret_val << std::endl;
+            }
+        }
+        else if (cmd == "readahead") {
+            if (cmd_line.size() != 2) {
+                std::cout << "Usage: readahead <blocks>\n";
+                continue;
+            }
+            arg1 = cmd_line[1];
+            // check return value so everything is ok
+            ret_val = filesystem.set_readahead(std::strtoul(arg1.c_str(), nullptr, 10));
+            if (ret_val) {
+                std::cout << "Error: readahead " << arg1;
+                std::cout << " failed, error code " << ret_val << std::endl;
+            }
+        }
+        else if (cmd == "cache") {
+            if (cmd_line.size() != 2) {
+                std::cout << "Usage: cache <blocks>\n";
+                continue;
+            }
+            arg1 = cmd_line[1];
+            // check return value so everything is ok
+            ret_val = filesystem.set_cache(std::strtoul(arg1.c_str(), nullptr, 10));
+            if (ret_val) {
+                std::cout << "Error: cache " << arg1;
+                std::cout << " failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "batch") {
+            if (cmd_line.size() != 1) {
+                std::cout << "Usage: batch\n";
+                continue;
+            }
+            // check return value so everything is ok
+            ret_val = filesystem.begin_batch();
+            if (ret_val) {
+                std::cout << "Error: batch failed, error code " << ret_val << std::endl;
+            }
+        }
+        else if (cmd == "commit") {
+            if (cmd_line.size() != 1) {
+                std::cout << "Usage: commit\n";
+                continue;
+            }
+            // check return value so everything is ok
+            ret_val = filesystem.commit_batch();
+            if (ret_val) {
+                std::cout << "Error: commit failed, error code " << ret_val << std::endl;
+            }
+        }
+
         else if (cmd == "quit")
             running = false;
 
         else if (cmd == "help") {
             std::cout << "Available commands:\n";
-            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, help, quit\n";
+            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, sync, durability, stats, readahead, cache, batch, commit, help, quit\n";
         }
 
         else if (cmd == "") {
@@ -246,7 +346,7 @@ Shell::run()
 
         else {
             std::cout << "Available commands:\n";
-            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, help, quit\n";
+            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, sync, durability, stats, readahead, cache, batch, commit, help, quit\n";
         }
     }
 }
@@ -196,15 +196,19 @@ Shell::run()
 
     PRINTDIV2;
 
-    std::cout << "Testing the number of files that fit in a directory ..." << std::endl;
+    std::cout << "Testing a directory with more files than fit in one block ..." << std::endl;
     std::cout << "Formatting disk ..." << std::endl;
     ret_val = filesystem.format();
 
     // check how many dir entries that fit in a block
     int no_dir_entries = BLOCK_SIZE / sizeof(dir_entry);
     std::cout << "BLOCK_SIZE = " << BLOCK_SIZE << ", sizeof(dir_entry) = " << sizeof(dir_entry) << ", " << no_dir_entries << " dir_entries per disk block." << std::endl;
-    std::cout << "Creating " << no_dir_entries << " files in the root directory..." << std::endl;
-    for (int i = 0; i < no_dir_entries; ++i) {
+    // a directory grows by a block when its blocks are full, so twice as
+    // many files as fit in one block all have to be created
+    int no_files = 2 * no_dir_entries;
+    int created = 0;
+    std::cout << "Creating " << no_files << " files in the root directory..." << std::endl;
+    for (int i = 0; i < no_files; ++i) {
         arg1 = "f" + std::to_string(i);
         fw = open("input1.txt", O_RDONLY);
         dup2(fw, 0);
@@ -213,33 +217,63 @@ Shell::run()
             std::cout << "Error: create " << arg1;
             std::cout << " failed, error code " << ret_val << std::endl;
         }
+        else {
+            created++;
+        }
         close(fw);
     }
     std::cout << "Expected output:" << std::endl;
+    std::cout << no_files << " files created" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << created << " files created" << std::endl;
+
+    std::cout << "--------\nReading a file in the second directory block..." << std::endl;
+    arg1 = "f" + std::to_string(no_files - 1);
+    std::cout << "Expected output:" << std::endl;
+    std::cout << input1;
+    std::cout << "Actual output:" << std::endl;
+    ret_val = filesystem.cat(arg1);
+    if (ret_val)
+    {
+        std::cout << "Error: cat " << arg1;
+        std::cout << " failed, error code " << ret_val << std::endl;
+    }
+
+    std::cout << "--------\nRemoving a file from each directory block..." << std::endl;
+    arg1 = "f1";
+    ret_val = filesystem.rm(arg1);
+    if (ret_val)
+    {
+        std::cout << "Error: rm " << arg1;
+        std::cout << " failed, error code " << ret_val << std::endl;
+    }
+    arg2 = "f" + std::to_string(no_files - 1);
+    ret_val = filesystem.rm(arg2);
+    if (ret_val)
+    {
+        std::cout << "Error: rm " << arg2;
+        std::cout << " failed, error code " << ret_val << std::endl;
+    }
+    std::cout << "Expected output:" << std::endl;
     std::cout << "name\t size" << std::endl;
     std::cout << "f0\t 16" << std::endl;
-    std::cout << "f1\t 16" << std::endl;
     std::cout << "f2\t 16" << std::endl;
     std::cout << "...\t ..." << std::endl;
-    std::cout << "f62\t 16" << std::endl;
-    std::cout << "f63\t 16" << std::endl;
+    std::cout << "f" << no_files - 3 << "\t 16" << std::endl;
+    std::cout << "f" << no_files - 2 << "\t 16" << std::endl;
     std::cout << "Actual output:" << std::endl;
     ret_val = filesystem.ls();
 
-    std::cout << "--------\nAdding one more file should give an error..." << std::endl;
+    std::cout << "--------\nA removed file should give an error..." << std::endl;
     std::cout << "Expected output:" << std::endl;
     std::cout << "... some kind of error message" << std::endl;
     std::cout << "Actual output:" << std::endl;
-    arg1 = "fx";
-    fw = open("input1.txt", O_RDONLY);
-    dup2(fw, 0);
-    ret_val = filesystem.create(arg1);
+    ret_val = filesystem.cat(arg2);
     if (ret_val)
     {
-        std::cout << "Error: create " << arg1;
+        std::cout << "Error: cat " << arg2;
         std::cout << " failed, error code " << ret_val << std::endl;
     }
-    close(fw);
 
     PRINTDIV2;
 
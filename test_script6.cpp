@@ -0,0 +1,245 @@
+/******************************************************************************
+ * Test program for the extensions of the file system: pread/pwrite past
+ * the end of a file at block-aligned sizes, file handles, reflink copies,
+ * and the content of the disk after a crash and a remount.
+ *****************************************************************************/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include "test_script.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+std::string commands_str[] = {
+    "format", "create", "cat", "ls",
+    "cp", "mv", "rm", "append",
+    "mkdir", "cd", "pwd",
+    "chmod",
+    "help", "quit"
+};
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+// the content of data as runs, e.g. "4096 x a, 10 x \0"
+static std::string
+runs(const std::string &data)
+{
+    std::ostringstream out;
+    for (size_t i = 0; i < data.size();) {
+        size_t j = i;
+        while (j < data.size() && data[j] == data[i]) {
+            j++;
+        }
+        out << (i ? ", " : "") << j - i << " x " << (data[i] ? std::string(1, data[i]) : "\\0");
+        i = j;
+    }
+    return out.str();
+}
+
+// reads the whole file with pread
+static std::string
+read_all(FS &fs, const std::string &filepath)
+{
+    std::vector<uint8_t> buf(16 * BLOCK_SIZE);
+    int n = fs.pread(filepath, 0, buf.size(), buf.data());
+    if (n < 0) {
+        return "(pread failed)";
+    }
+    return std::string(buf.begin(), buf.begin() + n);
+}
+
+void
+Shell::run()
+{
+    int ret_val = 0;
+    std::string a(BLOCK_SIZE, 'a');
+    std::string b(BLOCK_SIZE, 'b');
+    std::string c(BLOCK_SIZE, 'c');
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 6 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing pwrite and pread..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    filesystem.format();
+    filesystem.create("/f", a);
+    std::cout << "pwrite(f, 4096, 4096 x b) at the block-aligned end of f..." << std::endl;
+    ret_val = filesystem.pwrite("/f", BLOCK_SIZE, reinterpret_cast<const uint8_t *>(b.data()), b.size());
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "4096" << std::endl;
+    std::cout << "4096 x a, 4096 x b" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << ret_val << std::endl;
+    std::cout << runs(read_all(filesystem, "/f")) << std::endl;
+    std::cout << "-----" << std::endl;
+
+    std::cout << "pwrite(f, 12288, 4096 x c) past the end of f, leaving a gap..." << std::endl;
+    ret_val = filesystem.pwrite("/f", 3 * BLOCK_SIZE, reinterpret_cast<const uint8_t *>(c.data()), c.size());
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "4096" << std::endl;
+    std::cout << "4096 x a, 4096 x b, 4096 x \\0, 4096 x c" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << ret_val << std::endl;
+    std::cout << runs(read_all(filesystem, "/f")) << std::endl;
+    std::cout << "-----" << std::endl;
+
+    std::cout << "pwrite(f, 8190, 4 x d) across a block boundary..." << std::endl;
+    ret_val = filesystem.pwrite("/f", 2 * BLOCK_SIZE - 2, reinterpret_cast<const uint8_t *>("dddd"), 4);
+    std::vector<uint8_t> buf(3 * BLOCK_SIZE);
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "4" << std::endl;
+    std::cout << "4094 x a, 4094 x b, 4 x d, 4094 x \\0" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << ret_val << std::endl;
+    ret_val = filesystem.pread("/f", 2, 3 * BLOCK_SIZE - 2, buf.data());
+    buf.resize(std::max(ret_val, 0));
+    std::cout << runs(std::string(buf.begin(), buf.end())) << std::endl;
+    std::cout << "-----" << std::endl;
+
+    std::cout << "pread(f, 16384, 10) at the end of f..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "0" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << filesystem.pread("/f", 4 * BLOCK_SIZE, 10, buf.data()) << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing file handles..." << std::endl;
+    std::cout << "write(h, 4096 x a/b/c) three times to an empty file..." << std::endl;
+    filesystem.create("/h", "");
+    int fd = filesystem.open("/h", READ | WRITE);
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "4096 4096 4096" << std::endl;
+    std::cout << "4096 x a, 4096 x b, 4096 x c" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << filesystem.write(fd, reinterpret_cast<const uint8_t *>(a.data()), a.size()) << " ";
+    std::cout << filesystem.write(fd, reinterpret_cast<const uint8_t *>(b.data()), b.size()) << " ";
+    std::cout << filesystem.write(fd, reinterpret_cast<const uint8_t *>(c.data()), c.size()) << std::endl;
+    std::cout << runs(read_all(filesystem, "/h")) << std::endl;
+    std::cout << "-----" << std::endl;
+    std::cout << "seek(h, 4000), read(h, 200)..." << std::endl;
+    buf.assign(200, 0);
+    filesystem.seek(fd, 4000);
+    ret_val = filesystem.read(fd, buf.data(), buf.size());
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "200" << std::endl;
+    std::cout << "96 x a, 104 x b" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << ret_val << std::endl;
+    std::cout << runs(std::string(buf.begin(), buf.end())) << std::endl;
+    filesystem.close(fd);
+    PRINTDIV2;
+
+    std::cout << "Testing reflink copies..." << std::endl;
+    std::cout << "cp --reflink(h, r), then pwrite(r, 4096, 10 x x)..." << std::endl;
+    filesystem.cp("/h", "/r", true);
+    filesystem.pwrite("/r", BLOCK_SIZE, reinterpret_cast<const uint8_t *>("xxxxxxxxxx"), 10);
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "h: 4096 x a, 4096 x b, 4096 x c" << std::endl;
+    std::cout << "r: 4096 x a, 10 x x, 4086 x b, 4096 x c" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << "h: " << runs(read_all(filesystem, "/h")) << std::endl;
+    std::cout << "r: " << runs(read_all(filesystem, "/r")) << std::endl;
+    std::cout << "-----" << std::endl;
+    std::cout << "rm(h), r keeps its blocks..." << std::endl;
+    filesystem.rm("/h");
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "r: 4096 x a, 10 x x, 4086 x b, 4096 x c" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << "r: " << runs(read_all(filesystem, "/r")) << std::endl;
+    std::cout << "-----" << std::endl;
+    // three free blocks are enough to copy the shared blocks of s, but not
+    // for the block that the pwrite adds after them
+    std::cout << "cp --reflink(r, s), fill the disk, rm(t) of 3 blocks, then pwrite(s, 12280, 20 x y)..." << std::endl;
+    filesystem.cp("/r", "/s", true);
+    filesystem.create("/t", std::string(3 * BLOCK_SIZE, 't'));
+    filesystem.create("/full", a);
+    for (uint32_t size = BLOCK_SIZE; filesystem.pwrite("/full", size, reinterpret_cast<const uint8_t *>(a.data()), a.size()) > 0; size += BLOCK_SIZE)
+        ;
+    filesystem.rm("/t");
+    ret_val = filesystem.pwrite("/s", 3 * BLOCK_SIZE - 8, reinterpret_cast<const uint8_t *>("yyyyyyyyyyyyyyyyyyyy"), 20);
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "-1" << std::endl;
+    std::cout << "s: 4096 x a, 10 x x, 4086 x b, 4096 x c" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << ret_val << std::endl;
+    std::cout << "s: " << runs(read_all(filesystem, "/s")) << std::endl;
+    std::cout << "-----" << std::endl;
+    std::cout << "rm(s), create(g) of 3 blocks, r keeps its blocks..." << std::endl;
+    filesystem.rm("/s");
+    ret_val = filesystem.create("/g", std::string(3 * BLOCK_SIZE, 'g'));
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "0" << std::endl;
+    std::cout << "r: 4096 x a, 10 x x, 4086 x b, 4096 x c" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << ret_val << std::endl;
+    std::cout << "r: " << runs(read_all(filesystem, "/r")) << std::endl;
+    PRINTDIV2;
+
+    // a second mount of the disk runs in a child process, the first one
+    // stays idle meanwhile and formats the disk afterwards
+    std::cout << "Testing the disk after a crash..." << std::endl;
+    filesystem.format();
+    filesystem.create("/k", std::string(2 * BLOCK_SIZE, 'k'));
+    filesystem.sync();
+    std::cout << "create(j) committed, then rm(k) and create(g) in an uncommitted batch, then a crash..." << std::endl;
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        FS *fs = new FS();
+        fs->set_durability(DURABILITY_OP);
+        fs->create("/j", "journaled\n");
+        fs->begin_batch();
+        fs->rm("/k");
+        fs->create("/g", std::string(2 * BLOCK_SIZE, 'g'));
+        std::cout.flush();
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "Replayed 1 transactions from the journal" << std::endl;
+    std::cout << "j: 10 bytes" << std::endl;
+    std::cout << "k: 8192 x k" << std::endl;
+    std::cout << "g: (pread failed)" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout.flush();
+    pid = fork();
+    if (pid == 0) {
+        {
+            FS fs;
+            std::cout << "j: " << read_all(fs, "/j").size() << " bytes" << std::endl;
+            std::cout << "k: " << runs(read_all(fs, "/k")) << std::endl;
+            std::cout << "g: " << read_all(fs, "/g") << std::endl;
+        }
+        std::cout.flush();
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+    filesystem.format();
+    PRINTDIV2;
+
+    std::cout << "... Task 6 done" << std::endl;
+    PRINTDIV;
+}
@@ -0,0 +1,171 @@
+/******************************************************************************
+ * Test program for fsd and its clients: two clients pipeline several
+ * requests each, every client gets its replies in request order and keeps
+ * its own current directory.
+ *****************************************************************************/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <csignal>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include "test_script.h"
+#include "fs.h"
+#include "fsclient.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+#define TEST_SOCKET "test7.sock"
+#define CONNECT_TRIES 100 // 10 ms apart, while fsd starts
+
+std::string commands_str[] = {
+    "format", "create", "cat", "ls",
+    "cp", "mv", "rm", "append",
+    "mkdir", "cd", "pwd",
+    "chmod",
+    "help", "quit"
+};
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+// connects to fsd, which may still be starting
+static int
+connect_fsd(FSClient &client)
+{
+    for (int i = 0; i < CONNECT_TRIES; i++) {
+        if (client.connect(TEST_SOCKET) == 0) {
+            return 0;
+        }
+        usleep(10000);
+    }
+    return -1;
+}
+
+// queues mkdir, cd, create, cat and pwd in the directory dir
+static void
+submit_requests(FSClient &client, const std::string &dir)
+{
+    client.submit(FSD_MKDIR, "/" + dir);
+    client.submit(FSD_CD, "/" + dir);
+    client.submit(FSD_CREATE, "f", "", "from " + dir);
+    client.submit(FSD_CAT, "f");
+    client.submit(FSD_PWD);
+}
+
+// prints the replies to the requests of submit_requests
+static void
+print_replies(FSClient &client, const std::string &name)
+{
+    struct fsd_result result;
+    while (client.get_pending() > 0) {
+        if (client.next_reply(result)) {
+            std::cout << name << ": next_reply failed" << std::endl;
+            return;
+        }
+        std::cout << name << ": " << result.tag << " " << result.status;
+        if (!result.data.empty()) {
+            std::cout << " " << result.data;
+        }
+        if (result.data.empty() || result.data.back() != '\n') {
+            std::cout << std::endl;
+        }
+    }
+}
+
+void
+Shell::run()
+{
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 7 ..." << std::endl;
+    PRINTDIV2;
+
+    // fsd mounts the disk in a child process, the shell's file system stays
+    // idle meanwhile and formats the disk afterwards
+    std::cout << "Starting fsd on an empty disk..." << std::endl;
+    filesystem.format();
+    filesystem.sync();
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, 1);
+        execl("./fsd", "fsd", TEST_SOCKET, (char *)nullptr);
+        _exit(1);
+    }
+    FSClient a, b;
+    if (connect_fsd(a) || connect_fsd(b)) {
+        std::cout << "Error: can't connect to fsd" << std::endl;
+    }
+
+    std::cout << "Pipelining mkdir, cd, create, cat and pwd from clients a and b..." << std::endl;
+    submit_requests(a, "a");
+    submit_requests(b, "b");
+    b.flush();
+    a.flush();
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "a: 0 0" << std::endl;
+    std::cout << "a: 1 0" << std::endl;
+    std::cout << "a: 2 0" << std::endl;
+    std::cout << "a: 3 0 from a" << std::endl;
+    std::cout << "a: 4 0 /a" << std::endl;
+    std::cout << "b: 0 0" << std::endl;
+    std::cout << "b: 1 0" << std::endl;
+    std::cout << "b: 2 0" << std::endl;
+    std::cout << "b: 3 0 from b" << std::endl;
+    std::cout << "b: 4 0 /b" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    print_replies(a, "a");
+    print_replies(b, "b");
+    std::cout << "-----" << std::endl;
+
+    std::cout << "cat(f) and cat(/b/f) from a, in its own directory..." << std::endl;
+    std::string out1, out2;
+    int ret1 = a.cat("f", out1);
+    int ret2 = a.cat("/b/f", out2);
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "0 from a" << std::endl;
+    std::cout << "0 from b" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << ret1 << " " << out1;
+    std::cout << ret2 << " " << out2;
+    std::cout << "-----" << std::endl;
+
+    std::cout << "ls from a while a pwd of a waits for its reply..." << std::endl;
+    a.submit(FSD_PWD);
+    ret1 = a.ls(out1);
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "-1" << std::endl;
+    std::cout << "a: 7 0 /a" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << ret1 << std::endl;
+    print_replies(a, "a");
+
+    a.disconnect();
+    b.disconnect();
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    filesystem.format();
+    PRINTDIV2;
+
+    std::cout << "... Task 7 done" << std::endl;
+    PRINTDIV;
+}